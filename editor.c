@@ -27,35 +27,122 @@ void die(const char *message) {
     exit(EXIT_FAILURE);
 }
 
-struct winsize w;
+/* the readline at index row, NULL beyond the last row */
+readline *container_row(container *con, int row) {
+    return lines_get(con->rows, row);
+}
+
+/* insert an empty row so that it becomes row number row */
+readline *container_insert_row(container *con, int row) {
+    readline *row_pointer = slab_alloc(sizeof(readline));
+    make_new_row(row_pointer);
+    con->rows = lines_insert(con->rows, row, row_pointer);
+    con->max_row = con->rows->lines;
+    return row_pointer;
+}
 
-int get_window_width() {
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-    return w.ws_col;
+void container_delete_row(container *con, int row) {
+    readline *row_pointer;
+    con->rows = lines_remove(con->rows, row, &row_pointer);
+    con->max_row = con->rows->lines;
+    if (row_pointer == NULL) return;
+    /* a save under way may still have to write it */
+    if (save_take(&con->save, row_pointer)) return;
+    free_row(row_pointer);
+    slab_free(row_pointer, sizeof(readline));
 }
 
-int get_window_height() {
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-    return w.ws_row;
+/* the text of a row of the document is about to change */
+void container_change_row(container *con, int row) {
+    if (con->minibuffer_mode || !con->save.saving) return;
+    save_keep(&con->save, container_row(con, row));
 }
 
-void make_new_row(readline *row_pointer) {
-    CURSOR   = 0;
-    LINE_END = 0;
-    MARGIN   = 0;
-    LINE_LEN = LINE_BLOCK_SIZE;
-    BUFFER   = calloc(LINE_LEN, sizeof(wint_t));
+/* the text of a row of the document changed */
+void container_touch_row(container *con, int row) {
+    if (con->minibuffer_mode) return;
+    trigram_touch(&con->index, row);
 }
 
-void extend_row(readline *row_pointer) {
-    LINE_LEN += LINE_BLOCK_SIZE;
-    BUFFER = realloc(BUFFER, sizeof(wint_t) * LINE_LEN);
-    for (int i = LINE_END; i < LINE_LEN + 0; i++)
-        BUFFER[i] = 0;
+/* log an edit of the document for undo, the minibuffer has no history */
+void container_record(container *con, int kind, int row, int cursor,
+                      const wint_t *text, int length) {
+    if (con->minibuffer_mode) return;
+    container_change_row(con, row);
+    undo_record(&con->undo, kind, row, cursor, text, length);
+    journal_record(&con->journal, kind, row, cursor, text, length);
 }
-void extend_container(container *con) {
-    con->row_length += ROW_BLOCK_SIZE;
-    con->rows = realloc(con->rows, sizeof(struct readline) * con->row_length);
+
+/* log the characters [from, from + n) of a row before they are deleted */
+void container_record_row(container *con, int kind, int row,
+                          readline *row_pointer, int from, int n) {
+    if (con->minibuffer_mode || n <= 0) return;
+    container_change_row(con, row);
+    wint_t *text = malloc(n * sizeof(wint_t));
+    row_copy_out(row_pointer, from, n, text);
+    undo_record(&con->undo, kind, row, from, text, n);
+    free(text);
+    journal_record(&con->journal, kind, row, from, NULL, n);
+}
+
+/* Insert text at (row, cursor), a newline breaks the row. The position
+ * after the text goes to end_row and end_cursor. */
+void container_insert_text(container *con, int row, int cursor,
+                           const wint_t *text, int length,
+                           int *end_row, int *end_cursor) {
+    container_change_row(con, row);
+    readline *row_pointer = container_row(con, row);
+    int first = 0;
+    while (first < length && text[first] != '\n') first++;
+    row_insert_n(row_pointer, cursor, text, first);
+    container_touch_row(con, row);
+    if (first == length) {
+        *end_row    = row;
+        *end_cursor = cursor + length;
+        return;
+    }
+    /* the rest of the row goes behind the last line of the text */
+    readline *tail = container_insert_row(con, row + 1);
+    row_append(tail, row_pointer, cursor + first);
+    row_truncate(row_pointer, cursor + first);
+    int start = first + 1;
+    for (int i = start; i < length; i++) {
+        if (text[i] != '\n') continue;
+        row++;
+        row_pointer = container_insert_row(con, row);
+        row_insert_n(row_pointer, 0, text + start, i - start);
+        start = i + 1;
+    }
+    row++;
+    row_insert_n(tail, 0, text + start, length - start);
+    container_touch_row(con, row);
+    *end_row    = row;
+    *end_cursor = length - start;
+}
+
+/* delete length characters at (row, cursor), a line break counts as
+ * one; whole rows in between are removed without being copied */
+void container_delete_text(container *con, int row, int cursor, int length) {
+    container_change_row(con, row);
+    readline *row_pointer = container_row(con, row);
+    int rest = LINE_END - cursor;
+    if (length <= rest) {
+        row_delete(row_pointer, cursor, length);
+        container_touch_row(con, row);
+        return;
+    }
+    row_truncate(row_pointer, cursor);
+    length -= rest + 1;
+    readline *next;
+    while ((next = container_row(con, row + 1)) != NULL && next->line_end < length) {
+        length -= next->line_end + 1;
+        container_delete_row(con, row + 1);
+    }
+    if (next != NULL) {
+        row_append(row_pointer, next, length);
+        container_delete_row(con, row + 1);
+    }
+    container_touch_row(con, row);
 }
 
 char *strdup (const char *s) {
@@ -71,57 +158,143 @@ char *strdup (const char *s) {
 
 void screen_set_cursor(int row, int cursor, int hpadding, int vpadding) {
     int real_cursor = cursor-hpadding+1;
-    printf("\033[%d;%df", row-vpadding+1, real_cursor < 1 ? 1 : real_cursor);
-}
-
-void screen_set_char(int row, int cursor, wint_t c, int hpadding, int vpadding) {
-    screen_set_cursor(row, cursor, hpadding, vpadding);
-    printf("%lc", c);
-}
-
-void screen_redraw(container *con, enum draw_mode mode) {
-    int start;
-    int max = MAX_ROW;
-    switch (mode) {
-        case WHOLE: start = VPADDING;  break;
-        case REGION_DOWN: start = CUR_ROW-1; break;
-        case REGION_UP: start = CUR_ROW;   break;
-        case LINE: start = CUR_ROW; max = CUR_ROW+1; break;
-    }
-    /* Only draw visible rows. Note: redrawing to window_height
-     * causes the terminal screen to scroll down (CR in final line)! */
-    if (MAX_ROW >= get_window_height())
-        max = get_window_height() - 1 + VPADDING;
-    /* Don't read unallocated line buffers */
-    if (max > MAX_ROW)
-        max = MAX_ROW;
+    term_printf("\033[%d;%df", row-vpadding+1, real_cursor < 1 ? 1 : real_cursor);
+}
+
+/* put the terminal cursor back to the cursor of the current row */
+void screen_restore_cursor(container *con) {
+    readline *row_pointer = container_row(con, CUR_ROW);
+    screen_set_cursor(CUR_ROW, row_pointer ? COLUMN : 0, HPADDING, VPADDING);
+}
+
+/* lay out the columns [hpadding, hpadding + width) of a row as screen
+ * cells, tabs are expanded to spaces. Returns the number of cells. */
+int screen_layout_row(readline *row_pointer, int hpadding, int width, wint_t *cells) {
+    int first  = row_index(row_pointer, hpadding);
+    int column = row_column(row_pointer, first);
+    /* every character takes at least one column */
+    int n = LINE_END - first;
+    if (n > width) n = width;
+    if (n <= 0) return 0;
+    wint_t chars[n];
+    row_copy_out(row_pointer, first, n, chars);
+    int k = 0;
+    for (int i = 0; i < n && column < hpadding + width; i++) {
+        if (chars[i] == 0x9) {
+            int next_tab_stop = (column/TAB_STOP_WIDTH + 1) * TAB_STOP_WIDTH;
+            for (; column < next_tab_stop && column < hpadding + width; column++)
+                if (column >= hpadding) cells[k++] = ' ';
+        } else {
+            cells[k++] = chars[i];
+            column++;
+        }
+    }
+    return k;
+}
+
+/* first match of the search in row at or after from, -1 if there is
+ * none; the character after it goes to end. A regexp search steps
+ * through the row last given to regex_row. */
+int isearch_row_match(isearch *search, readline *row_pointer, int from, int *end) {
+    if (search->regexp) {
+        int start;
+        if (search->re == NULL || !regex_next(search->re, from, &start, end))
+            return -1;
+        return start;
+    }
+    int at = search_row(&search->pattern, row_pointer, from);
+    *end = at + search->pattern.length;
+    return at;
+}
+
+/* mark the matches of the incremental search in the cells of row i,
+ * returns the new number of cells */
+int screen_highlight(container *con, readline *row_pointer, int i,
+                     int hpadding, int width, wint_t *cells, int n) {
+    isearch *search = &con->search;
+    int length = search->pattern.length;
+    if (search->regexp ? search->re == NULL
+                       : length == 0 || search->pattern.lines) return n;
+    search_match *current = search->failing || search->match_count == 0
+                            ? NULL : &search->matches[search->current];
+    /* a regexp match may start anywhere before the visible part */
+    int from = search->regexp ? 0 : row_index(row_pointer, hpadding) - length;
+    int stop;
+    if (search->regexp) regex_row(search->re, row_pointer);
+    for (int at = isearch_row_match(search, row_pointer, from, &stop); at >= 0;
+             at = isearch_row_match(search, row_pointer, at + 1, &stop)) {
+        int start = row_column(row_pointer, at) - hpadding;
+        int end   = row_column(row_pointer, stop) - hpadding;
+        if (start >= width) break;
+        if (end > width) end = width;
+        int attr = (current && current->row == i && current->cursor == at)
+                   ? RENDER_CURRENT : RENDER_MATCH;
+        for (; n < end; n++) cells[n] = ' ';
+        /* matches may overlap, the current one stays on top */
+        for (int c = start < 0 ? 0 : start; c < end; c++)
+            if ((cells[c] & RENDER_ATTRS) != RENDER_CURRENT)
+                cells[c] = (cells[c] & ~RENDER_ATTRS) | attr;
+    }
+    return n;
+}
+
+/* Mark the rows [from, to) as changed. Nothing is drawn until
+ * screen_render compares them with what the terminal shows. */
+void screen_damage(container *con, int from, int to) {
     /* Make sure the whole tab is printed on screen */
-    readline *row_pointer = &con->rows[con->current_row];
-    if (HPADDING) 
-        HPADDING = ((CURSOR-1)/TAB_STOP_WIDTH) * TAB_STOP_WIDTH;
-    if (LINE_END + HPADDING >= LINE_LEN) extend_row(row_pointer);
-    if (mode == WHOLE) ANSI_RESET_SCREEN;
-    for (int i = start; i < max; i++) {
-        screen_set_cursor(i, 0, HPADDING, VPADDING);
-        ANSI_KILL_LINE;
-        if(con->rows[i].buffer != NULL) {
-            for (int j = 0; j < get_window_width()-1; j++) {
-                if (j >= con->rows[i].line_end-HPADDING) break;
-                printf("%lc", con->rows[i].buffer[j+HPADDING]);
-            }
+    readline *row_pointer = container_row(con, CUR_ROW);
+    if (HPADDING && row_pointer && !con->minibuffer_mode) 
+        HPADDING = ((COLUMN-1)/TAB_STOP_WIDTH) * TAB_STOP_WIDTH;
+    if (from < con->damage_from) con->damage_from = from;
+    if (to   > con->damage_to)   con->damage_to   = to;
+}
+
+/* Draw the damaged rows of the visible part of the document. A changed
+ * scroll position damages every row, a vertical scroll is left to the
+ * terminal first. */
+void screen_render(container *con) {
+    static int drawn_vpadding = -1;
+    static int drawn_hpadding = -1;
+    /* the minibuffer scrolls on its own */
+    int hpadding = con->minibuffer_mode ? con->temp_hpadding : HPADDING;
+    int height   = term_height() - 1;
+    int width    = term_width() - 1;
+    int from     = con->damage_from;
+    int to       = con->damage_to;
+    int resized  = render_begin(height, width);
+    if (resized || VPADDING != drawn_vpadding || hpadding != drawn_hpadding) {
+        /* rows that stay visible are moved by the terminal */
+        if (!resized && drawn_vpadding >= 0)
+            render_scroll(VPADDING - drawn_vpadding);
+        from = VPADDING;
+        to   = VPADDING + height;
+    }
+    if (from < VPADDING)          from = VPADDING;
+    if (to   > VPADDING + height) to   = VPADDING + height;
+    if (from < to && width > 0) {
+        wint_t cells[width];
+        line_iter iter;
+        readline *row_pointer = lines_iter_start(con->rows, from, &iter);
+        for (int i = from; i < to; i++, row_pointer = lines_iter_next(&iter)) {
+            int n = row_pointer ? screen_layout_row(row_pointer, hpadding, width, cells) : 0;
+            if (row_pointer && con->search.active)
+                n = screen_highlight(con, row_pointer, i, hpadding, width, cells, n);
+            render_row(i - VPADDING, cells, n);
         }
     }
-    /* erase last line */
-    screen_set_cursor(MAX_ROW, 0, HPADDING, VPADDING);
-    ANSI_KILL_LINE;
+    render_end();
+    drawn_vpadding   = VPADDING;
+    drawn_hpadding   = hpadding;
+    con->damage_from = INT_MAX;
+    con->damage_to   = 0;
 }
 
 void minibuffer_redraw(container *con, readline *row_pointer) {
-    screen_set_cursor(get_window_height()-1, MARGIN, 0, 0);
+    screen_set_cursor(term_height()-1, MARGIN, 0, 0);
     ANSI_KILL_LINE;
-    for (int j = MARGIN; j < get_window_width()-1; j++) {
+    for (int j = MARGIN; j < term_width()-1; j++) {
         if (j >= LINE_END-HPADDING) break;
-        printf("%lc", BUFFER[j+HPADDING]);
+        term_putwc(row_get(row_pointer, j+HPADDING));
     }
    
 }
@@ -130,83 +303,38 @@ void minibuffer_redraw(container *con, readline *row_pointer) {
     low level functions altering the buffer
  -----------------------------------------------*/
 
-void buffer_set_char(wint_t buffer[], int cursor, wint_t c) {
-    buffer[cursor] = c;
-}
-
-void buffer_shift_region_right(wint_t buffer[], int row, int cursor, int line_end) {
-    memmove(
-            &buffer[cursor+1],
-            &buffer[cursor],
-            (line_end-cursor) * sizeof(wint_t)
-            );
-}
-
-void buffer_shift_region_left(wint_t buffer[], int row, int cursor, int line_end) {
-    memmove(
-            &buffer[cursor-1],
-            &buffer[cursor],
-            (line_end-cursor) * sizeof(wint_t)
-            );
-}
-
-char buffer_is_space(wint_t buffer[], int cursor) {
-    return (buffer[cursor] == 32) ? TRUE : FALSE;
+char buffer_is_space(readline *row_pointer, int cursor) {
+    return (row_get(row_pointer, cursor) == 32) ? TRUE : FALSE;
 }
 
-void buffer_shift_line_down(container *con) {
-    memmove(
-            &con->rows[con->current_row+1],
-            &con->rows[con->current_row],
-            (con->max_row - con->current_row) * sizeof(readline)
-            );
-}
-void buffer_shift_line_up(container *con) {
-    memmove(
-            &con->rows[con->current_row],
-            &con->rows[con->current_row+1],
-            (con->max_row - con->current_row) * sizeof(readline)
-            );
-}
 
 /*-----------------------------------------------  
     high level editor functions altering the buffer
  -----------------------------------------------*/
 
 readline *editor_newline(container *con, readline *row_pointer) {
-    buffer_shift_line_down(con);
-    if (MAX_ROW + 1 == con->row_length) extend_container(con);
+    wint_t newline = 0xA;
+    container_record(con, UNDO_INSERT, CUR_ROW, CURSOR, &newline, 1);
+    readline *row_pointer_prev = row_pointer;
     CUR_ROW++;
-    /* two cols pointing to same buffer! */
-    con->rows[CUR_ROW].buffer = NULL; 
-    row_pointer = &con->rows[CUR_ROW];
-    make_new_row(row_pointer);
-    MAX_ROW++;
-    readline *row_pointer_prev;
-    row_pointer_prev = &con->rows[CUR_ROW-1];
-    /* make sure it fits */
-    while (row_pointer->line_length < LINE_END_PREV + LINE_END)
-        extend_row(row_pointer);
-    /* copy down from line above */
-    for (int i = 0; i <= (LINE_END_PREV - CURSOR_PREV); i++) {
-        BUFFER[i] = BUFFER_PREV[CURSOR_PREV + i];
-        BUFFER_PREV[CURSOR_PREV + i]  = 0;
-    }
-    LINE_END = LINE_END_PREV - CURSOR_PREV;
-    LINE_END_PREV = CURSOR_PREV;
-    buffer_set_char(BUFFER_PREV, CURSOR_PREV,  0xA);
+    row_pointer = container_insert_row(con, CUR_ROW);
+    /* move the text right of the cursor down to the new line */
+    row_append(row_pointer, row_pointer_prev, CURSOR_PREV);
+    row_truncate(row_pointer_prev, CURSOR_PREV);
+    container_touch_row(con, CUR_ROW - 1);
+    container_touch_row(con, CUR_ROW);
 
     char redraw = FALSE;
     if(HPADDING) {
         HPADDING = 0;
         redraw = TRUE;
     }
-    if(CUR_ROW - VPADDING == get_window_height() - 1) {
+    if(CUR_ROW - VPADDING == term_height() - 1) {
         VPADDING++;
         redraw = TRUE;
     }
-    redraw ? screen_redraw(con, WHOLE) : screen_redraw(con, REGION_DOWN);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    redraw ? screen_damage(con, 0, SCREEN_END) : screen_damage(con, CUR_ROW-1, SCREEN_END);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
@@ -214,326 +342,360 @@ readline* editor_insert_char(container *con, readline *row_pointer, wint_t unich
     if (con->minibuffer_mode && unichar == 0xA) return row_pointer;
     /* with the current temios settings a window resize inserts the char -1, ignore this */
     if (unichar == -1) return row_pointer;
-    /* If a tab character is encountered fill space until tab stop is reached */
-    if (BUFFER[CURSOR] == 0x9) {
-        BUFFER[CURSOR] = unichar;
-        CURSOR++;
-        int current_tab_stop = (CURSOR/TAB_STOP_WIDTH) * TAB_STOP_WIDTH;
-        if (CURSOR == current_tab_stop) {
-            editor_insert_tab(con, row_pointer);
-            CURSOR = current_tab_stop;
-        } else {
-            BUFFER[CURSOR] = 0x9;
-            screen_redraw(con, LINE);
-        }
-        screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-        return row_pointer;
-    }
-    LINE_END++;
-    if (LINE_END >= LINE_LEN) extend_row(row_pointer);
-    buffer_shift_region_right(BUFFER, CUR_ROW, CURSOR, LINE_END);
-    buffer_set_char(BUFFER, CURSOR, unichar);
-    if (CURSOR-HPADDING >= get_window_width() - 1) { 
+    container_record(con, UNDO_INSERT, CUR_ROW, CURSOR, &unichar, 1);
+    row_insert(row_pointer, CURSOR, unichar);
+    container_touch_row(con, CUR_ROW);
+    if (row_column(row_pointer, CURSOR+1) - HPADDING >= term_width()) { 
         HPADDING++;
         if (con->minibuffer_mode)
             minibuffer_redraw(con, row_pointer);
         else 
-            screen_redraw(con, WHOLE);
+            screen_damage(con, 0, SCREEN_END);
     } else {
         if (con->minibuffer_mode)
             minibuffer_redraw(con, row_pointer);
         else
-            screen_redraw(con, LINE);
+            screen_damage(con, CUR_ROW, CUR_ROW+1);
     }
     CURSOR++;
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
+    return row_pointer;
+}
+
+/* Insert text at the cursor in one go, a newline breaks the row. Each
+ * row grows once, rows for the lines of the text are created on the
+ * way and the screen is drawn once. */
+readline *editor_insert_string(container *con, readline *row_pointer,
+                               const wint_t *text, int length) {
+    if (con->minibuffer_mode || length <= 0) return row_pointer;
+    /* the text is undone apart from what was typed before it */
+    undo_command(&con->undo);
+    container_record(con, UNDO_INSERT, CUR_ROW, CURSOR, text, length);
+    int row = CUR_ROW;
+    int end_row, end_cursor;
+    container_insert_text(con, row, CURSOR, text, length, &end_row, &end_cursor);
+    CUR_ROW     = end_row;
+    row_pointer = container_row(con, CUR_ROW);
+    CURSOR      = end_cursor;
+
+    char redraw = FALSE;
+    if (CUR_ROW - VPADDING >= term_height() - 1) {
+        VPADDING = CUR_ROW - term_height() + 2;
+        redraw = TRUE;
+    }
+    int width = term_width();
+    if (COLUMN < HPADDING || COLUMN - HPADDING >= width) {
+        HPADDING = COLUMN < width ? 0 : COLUMN - width + 1;
+        redraw = TRUE;
+    }
+    if (redraw)              screen_damage(con, 0, SCREEN_END);
+    else if (CUR_ROW != row) screen_damage(con, row, SCREEN_END);
+    else                     screen_damage(con, row, row+1);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline* editor_insert_tab(container *con, readline *row_pointer) {
     if (con->minibuffer_mode) return row_pointer;
-    /* insert tab character, then fill buffer with TAB_PAD_CHAR until
-     * next tab stop is reached  */
-    int next_tab_stop = (CURSOR/TAB_STOP_WIDTH) * TAB_STOP_WIDTH + TAB_STOP_WIDTH;
-    editor_insert_char(con, row_pointer, KEY_TAB);
-    for(int i = CURSOR; i < next_tab_stop; i++)
-        editor_insert_char(con, row_pointer, TAB_PAD_CHAR);
-    screen_redraw(con, LINE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-    return row_pointer;
+    /* the tab is a single character, its width is left to the display */
+    return editor_insert_char(con, row_pointer, KEY_TAB);
 }
 
 readline* editor_delete_char(container *con, readline *row_pointer, wint_t unichar) {
     if (CURSOR == MARGIN && con->minibuffer_mode) return row_pointer;
     if (CURSOR == 0) return editor_delete_line(con, row_pointer, unichar);
-    if (BUFFER[CURSOR-1] == TAB_PAD_CHAR) {
-        while (BUFFER[CURSOR-1] == TAB_PAD_CHAR) {
-            buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR, LINE_END+1);
-            buffer_set_char(BUFFER, LINE_END, 0);
-            CURSOR--;
-            LINE_END--;
-        }
-    }
-    buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR, LINE_END+1);
-    buffer_set_char(BUFFER, LINE_END, 0);
-    if (CURSOR <= HPADDING - 1) {
+    container_record_row(con, UNDO_ERASE, CUR_ROW, row_pointer, CURSOR-1, 1);
+    row_delete(row_pointer, CURSOR-1, 1);
+    container_touch_row(con, CUR_ROW);
+    CURSOR--;
+    if (COLUMN <= HPADDING - 1) {
         HPADDING--;
-        screen_redraw(con, WHOLE);
+        screen_damage(con, 0, SCREEN_END);
     } else {
         if (con->minibuffer_mode)
             minibuffer_redraw(con, row_pointer);
         else
-            screen_redraw(con, LINE);
+            screen_damage(con, CUR_ROW, CUR_ROW+1);
     }
-    LINE_END--;
-    CURSOR--;
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline* editor_delete_forward_char(container *con, readline *row_pointer, wint_t unichar) {
     if (CURSOR == LINE_END) return row_pointer;
-    if (BUFFER[CURSOR] == 0x9) {
-        do {
-            buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR, LINE_END+1);
-            buffer_set_char(BUFFER, LINE_END, 0);
-            LINE_END--;
-        } while (BUFFER[CURSOR] == TAB_PAD_CHAR);
-        screen_redraw(con, LINE);
-        screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-        return row_pointer;
-    }
-    buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR+1, LINE_END+1);
-    LINE_END--;
-    screen_redraw(con, LINE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    container_record_row(con, UNDO_DELETE, CUR_ROW, row_pointer, CURSOR, 1);
+    row_delete(row_pointer, CURSOR, 1);
+    container_touch_row(con, CUR_ROW);
+    screen_damage(con, CUR_ROW, CUR_ROW+1);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline* editor_delete_forward_word(container *con, readline *row_pointer, wint_t unichar) {
     if (CURSOR == LINE_END) return row_pointer;
-    /* cursor at space */
-    if (BUFFER[CURSOR] == 32) {
-        while (buffer_is_space(BUFFER, CURSOR)) {
-            buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR, LINE_END+1);
-            buffer_set_char(BUFFER, LINE_END, 0);
-            LINE_END--;
-        } 
-        screen_redraw(con, LINE);
-        screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-        return row_pointer;
-    }
-    /* cursor at tab */
-    if (BUFFER[CURSOR] == 0x9) {
-        do {
-            buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR, LINE_END+1);
-            buffer_set_char(BUFFER, LINE_END, 0);
-            LINE_END--;
-        } while (BUFFER[CURSOR] == TAB_PAD_CHAR);
-        screen_redraw(con, LINE);
-        screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-        return row_pointer;
-    }
-    /* cursor at char */
-    while (!buffer_is_space(BUFFER, CURSOR) && CURSOR != LINE_END) {
-        /* if we are inside a tab stop delete padding and return */
-        if (BUFFER[CURSOR] == TAB_PAD_CHAR) {
-            do {
-                buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR, LINE_END+1);
-                buffer_set_char(BUFFER, LINE_END, 0);
-                LINE_END--;
-            } while (BUFFER[CURSOR] == TAB_PAD_CHAR);
-            screen_redraw(con, LINE);
-            screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-            return row_pointer;
+    /* find the end of the region first, then delete it in one go */
+    int end = CURSOR;
+    if (buffer_is_space(row_pointer, CURSOR)) {
+        /* cursor at space */
+        while (buffer_is_space(row_pointer, end)) end++;
+    } else {
+        /* cursor at char, a tab ends the word */
+        while (!buffer_is_space(row_pointer, end) && end != LINE_END) {
+            if (row_get(row_pointer, end++) == 0x9) break;
         }
-        buffer_shift_region_left(BUFFER, CUR_ROW, CURSOR, LINE_END+1);
-        buffer_set_char(BUFFER, LINE_END, 0);
-        LINE_END--;
-    } 
-    screen_redraw(con, LINE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    }
+    container_record_row(con, UNDO_DELETE, CUR_ROW, row_pointer, CURSOR, end - CURSOR);
+    row_delete(row_pointer, CURSOR, end - CURSOR);
+    container_touch_row(con, CUR_ROW);
+    screen_damage(con, CUR_ROW, CUR_ROW+1);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline* editor_delete_line(container *con, readline *row_pointer, wint_t unichar) {
     if (CUR_ROW == 0) return row_pointer;
     readline *row_pointer_prev;
-    row_pointer_prev = &con->rows[CUR_ROW-1];
-    /* make sure it fits */
-    while (row_pointer_prev->line_length < LINE_END_PREV + LINE_END)
-        extend_row(row_pointer_prev);
+    row_pointer_prev = container_row(con, CUR_ROW-1);
+    wint_t newline = 0xA;
+    container_record(con, UNDO_ERASE, CUR_ROW-1, LINE_END_PREV, &newline, 1);
     /* copy up to line above */
-    for (int i = 0; i <= LINE_END; i++) {
-        BUFFER_PREV[LINE_END_PREV + i] = BUFFER[i];
-    }
-    LINE_END_PREV = LINE_END_PREV + LINE_END;
-    MAX_ROW--;
-    buffer_shift_line_up(con);
-    con->rows[MAX_ROW].buffer = NULL;
-    con->rows[MAX_ROW].cursor = 0;
-    con->rows[MAX_ROW].line_end = 0;
+    row_append(row_pointer_prev, row_pointer, 0);
+    container_delete_row(con, CUR_ROW);
     CUR_ROW--;
+    container_touch_row(con, CUR_ROW);
     char redraw = FALSE;
     if (CUR_ROW + 1 == VPADDING) {
         VPADDING--;
         redraw = TRUE;
     }
-    redraw ? screen_redraw(con, WHOLE) : screen_redraw(con, REGION_UP);
-    row_pointer = &con->rows[CUR_ROW];
+    redraw ? screen_damage(con, 0, SCREEN_END) : screen_damage(con, CUR_ROW, SCREEN_END);
+    row_pointer = row_pointer_prev;
     CURSOR = 0; /* no need to reset HPADDING, function can only called if HPADDING = 0 */
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
+/* copy the characters [from, to) of row_pointer to the yank line */
+void yank_copy(readline *yank_line_pointer, readline *row_pointer, int from, int to) {
+    free_row(yank_line_pointer);
+    make_new_row(yank_line_pointer);
+    if (to <= from) return;
+    wint_t *chars = malloc((to - from) * sizeof(wint_t));
+    row_copy_out(row_pointer, from, to - from, chars);
+    row_insert_n(yank_line_pointer, 0, chars, to - from);
+    free(chars);
+}
+
 readline* editor_kill_to_end_of_line(container *con, readline *row_pointer, readline *yank_line_pointer) {
     if (con->minibuffer_mode) return row_pointer;
-    if (yank_line_pointer->buffer) free(yank_line_pointer->buffer);
-    yank_line_pointer->buffer = malloc((LINE_END - CURSOR) * sizeof(wint_t));
-    yank_line_pointer->line_end = 0; 
-    for (int i = 0, k = 0; i < (LINE_END - CURSOR); i++) {
-        if (BUFFER[CURSOR + i] != TAB_PAD_CHAR) {
-            yank_line_pointer->buffer[k] = BUFFER[CURSOR + i];
-            yank_line_pointer->line_end++;
-            k++;
-        }
-        BUFFER[CURSOR + i] = 0;
-        screen_set_char(CUR_ROW, CURSOR + i, ' ', HPADDING, VPADDING); 
-    }
-    BUFFER[CURSOR] = BUFFER[LINE_END]; /* copy CR or 0 */
-    BUFFER[LINE_END] = 0;
-    LINE_END = CURSOR;
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    yank_copy(yank_line_pointer, row_pointer, CURSOR, LINE_END);
+    container_record_row(con, UNDO_DELETE, CUR_ROW, row_pointer, CURSOR, LINE_END - CURSOR);
+    row_truncate(row_pointer, CURSOR);
+    container_touch_row(con, CUR_ROW);
+    screen_damage(con, CUR_ROW, CUR_ROW+1);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return yank_line_pointer;
 }
 
 readline *editor_kill_to_beginning_of_line(container *con, readline *row_pointer, readline *yank_line_pointer) {
     if (con->minibuffer_mode) return row_pointer;
     if (CURSOR == 0) return yank_line_pointer;
-    if (yank_line_pointer->buffer) free(yank_line_pointer->buffer);
-    yank_line_pointer->buffer = malloc(CURSOR * sizeof(wint_t));
-    yank_line_pointer->line_end = 0;
     /* copy to yank line */
-    for (int i = 0, k = 0; i < CURSOR; i++) {
-        if (BUFFER[i] != TAB_PAD_CHAR) {
-            yank_line_pointer->buffer[k] = BUFFER[i];
-            yank_line_pointer->line_end++;
-            k++;
-        }
-    }
-    /* move values right from cursor to line start */
-    for (int i = CURSOR, k = 0; i < LINE_END+1; i++, k++)
-        BUFFER[k] = BUFFER[i];
-    /* delete excess characters */
-    for (int i = LINE_END - CURSOR + 1 ; i <= LINE_END; i++)
-        BUFFER[i] = 0;
-    LINE_END -= CURSOR;
+    yank_copy(yank_line_pointer, row_pointer, 0, CURSOR);
+    container_record_row(con, UNDO_ERASE, CUR_ROW, row_pointer, 0, CURSOR);
+    row_delete(row_pointer, 0, CURSOR);
+    container_touch_row(con, CUR_ROW);
     CURSOR = 0;
-    screen_redraw(con, LINE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_damage(con, CUR_ROW, CUR_ROW+1);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return yank_line_pointer;
 }
 
 readline *editor_yank_line(container *con, readline *row_pointer, readline *yank_line_pointer) {
     if (con->minibuffer_mode) return row_pointer;
-    if (yank_line_pointer->buffer == NULL) return row_pointer;
-    for (int i = 0; i < yank_line_pointer->line_end; i++) {
-        if (yank_line_pointer->buffer[i] == 0x9)
-            editor_insert_tab(con, row_pointer);
-        else
-            editor_insert_char(con, row_pointer, yank_line_pointer->buffer[i]);
+    int n = yank_line_pointer->line_end;
+    if (n == 0) return row_pointer;
+    wint_t *text = malloc(n * sizeof(wint_t));
+    row_copy_out(yank_line_pointer, 0, n, text);
+    row_pointer = editor_insert_string(con, row_pointer, text, n);
+    free(text);
+    return row_pointer;
+}
+
+/*-----------------------------------------------  
+    undo
+ -----------------------------------------------*/
+
+/* put the cursor at (row, cursor) after an undo, the whole screen is
+ * drawn once however many rows changed */
+readline *undo_show(container *con, int row, int cursor) {
+    readline *row_pointer = container_row(con, row);
+    CUR_ROW = row;
+    CURSOR  = cursor;
+    if (row < VPADDING || row >= VPADDING + term_height() - 1) {
+        VPADDING = row - term_height() / 2;
+        if (VPADDING < 0) VPADDING = 0;
     }
+    int width = term_width() - 1;
+    if (COLUMN < HPADDING || COLUMN >= HPADDING + width)
+        HPADDING = COLUMN < width ? 0 : COLUMN - width / 2;
+    screen_damage(con, 0, SCREEN_END);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
+/* C-/: revert the edits of the last command that is not undone yet,
+ * newest first. A kill or a yank is a single entry of the log and is
+ * reverted by a single insert or delete. */
+readline *editor_undo(container *con, readline *row_pointer, wint_t unichar) {
+    if (con->minibuffer_mode) return row_pointer;
+    undo_log   *log = &con->undo;
+    undo_entry *e   = log->top;
+    if (e == NULL) {
+        infobar_print(con, "No further undo information\0");
+        return row_pointer;
+    }
+    int group  = e->group;
+    int row    = e->row;
+    int cursor = e->cursor;
+    for (; e != NULL && e->group == group; e = e->prev) {
+        row    = e->row;
+        cursor = e->cursor;
+        if (e->kind == UNDO_INSERT) {
+            journal_record(&con->journal, UNDO_DELETE, e->row, e->cursor, NULL, e->length);
+            container_delete_text(con, e->row, e->cursor, e->length);
+            continue;
+        }
+        wint_t *text = malloc(e->length * sizeof(wint_t));
+        int end_row, end_cursor, length = undo_text(e, text);
+        journal_record(&con->journal, UNDO_INSERT, e->row, e->cursor, text, length);
+        container_insert_text(con, e->row, e->cursor, text, length,
+                              &end_row, &end_cursor);
+        free(text);
+        /* backspace leaves the cursor behind the restored text */
+        if (e->kind == UNDO_ERASE) {
+            row    = end_row;
+            cursor = end_cursor;
+        }
+    }
+    log->top = e;
+    return undo_show(con, row, cursor);
+}
+
+/* M-_: apply the edits of the next command that was undone */
+readline *editor_redo(container *con, readline *row_pointer, wint_t unichar) {
+    if (con->minibuffer_mode) return row_pointer;
+    undo_log   *log = &con->undo;
+    undo_entry *e   = undo_next(log);
+    if (e == NULL) {
+        infobar_print(con, "No further redo information\0");
+        return row_pointer;
+    }
+    int group  = e->group;
+    int row    = e->row;
+    int cursor = e->cursor;
+    for (; e != NULL && e->group == group; e = e->next) {
+        row    = e->row;
+        cursor = e->cursor;
+        if (e->kind == UNDO_INSERT) {
+            wint_t *text = malloc(e->length * sizeof(wint_t));
+            int length = undo_text(e, text);
+            journal_record(&con->journal, UNDO_INSERT, e->row, e->cursor, text, length);
+            container_insert_text(con, e->row, e->cursor, text, length, &row, &cursor);
+            free(text);
+        } else {
+            journal_record(&con->journal, UNDO_DELETE, e->row, e->cursor, NULL, e->length);
+            container_delete_text(con, e->row, e->cursor, e->length);
+        }
+        log->top = e;
+    }
+    return undo_show(con, row, cursor);
+}
+
 /*-----------------------------------------------  
     high level editor functions: movement
  -----------------------------------------------*/
 
 readline* editor_forward_char(container *con, readline *row_pointer, wint_t unichar) {
     if (CURSOR < LINE_END) {
-        do {
-            CURSOR++;
-            if (CURSOR-HPADDING >= get_window_width() - 1) {
-                HPADDING++;
-                if (con->minibuffer_mode)
-                    minibuffer_redraw(con, row_pointer);
-                else
-                    screen_redraw(con, WHOLE);
-            }
-            screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-        } while (BUFFER[CURSOR] == TAB_PAD_CHAR);
+        CURSOR++;
+        if (COLUMN-HPADDING >= term_width() - 1) {
+            HPADDING++;
+            if (con->minibuffer_mode)
+                minibuffer_redraw(con, row_pointer);
+            else
+                screen_damage(con, 0, SCREEN_END);
+        }
+        screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     }
     return row_pointer;
 }
 
 readline* editor_backward_char(container *con, readline *row_pointer, wint_t unichar) {
     if (CURSOR > MARGIN) {
-        do {
-            CURSOR--;
-            if (CURSOR-MARGIN <= HPADDING - 1) {
-                HPADDING--;
-                if (con->minibuffer_mode)
-                    minibuffer_redraw(con, row_pointer);
-                else
-                    screen_redraw(con, WHOLE);
-            }
-            screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
-        } while (BUFFER[CURSOR] == TAB_PAD_CHAR);
+        CURSOR--;
+        if (COLUMN-MARGIN <= HPADDING - 1) {
+            HPADDING--;
+            if (con->minibuffer_mode)
+                minibuffer_redraw(con, row_pointer);
+            else
+                screen_damage(con, 0, SCREEN_END);
+        }
+        screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     }
     return row_pointer;
 }
 
 readline* editor_forward_word(container *con, readline *row_pointer, wint_t unichar) {
     START:
-    if (!buffer_is_space(BUFFER, CURSOR)) { 
-        while(!buffer_is_space(BUFFER, CURSOR)) {
+    if (!buffer_is_space(row_pointer, CURSOR)) { 
+        while(!buffer_is_space(row_pointer, CURSOR)) {
             if (CURSOR == LINE_END) break;
             CURSOR++;
         }
     } else {
-        while(buffer_is_space(BUFFER, CURSOR)) { /* skip white space */
+        while(buffer_is_space(row_pointer, CURSOR)) { /* skip white space */
             if (CURSOR == LINE_END) break;
             CURSOR++;
         }
         goto START;
     }
-    if (CURSOR-HPADDING >= get_window_width() - 1) {
-        HPADDING = LINE_END - get_window_width() + 1;
+    if (COLUMN-HPADDING >= term_width() - 1) {
+        HPADDING = COLUMN - term_width() + 1;
         if (con->minibuffer_mode)
             minibuffer_redraw(con, row_pointer);
         else
-            screen_redraw(con, WHOLE);
+            screen_damage(con, 0, SCREEN_END);
     } 
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline* editor_backward_word(container *con, readline *row_pointer, wint_t unichar) {
     if (CURSOR == LINE_END) CURSOR--;
     START:
-    if (!buffer_is_space(BUFFER, CURSOR)) {
-        while (!buffer_is_space(BUFFER, CURSOR)) { 
+    if (!buffer_is_space(row_pointer, CURSOR)) {
+        while (!buffer_is_space(row_pointer, CURSOR)) { 
             if (CURSOR == MARGIN) break;
             CURSOR--;
         }
     } else {
-        while(buffer_is_space(BUFFER, CURSOR)) {
+        while(buffer_is_space(row_pointer, CURSOR)) {
             if (CURSOR == MARGIN) break;
             CURSOR--;
         }
         if (CURSOR != MARGIN) goto START;
     }
-    if (CURSOR-MARGIN <= HPADDING - 1) {
+    if (COLUMN-MARGIN <= HPADDING - 1) {
         HPADDING--;
         if (con->minibuffer_mode) {
             CURSOR = MARGIN+HPADDING; /* not as expected */
             minibuffer_redraw(con, row_pointer);
         } else {
-            screen_redraw(con, WHOLE);
+            screen_damage(con, 0, SCREEN_END);
         }
     }
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
@@ -544,22 +706,22 @@ readline* editor_move_beginning_of_line(container *con, readline *row_pointer, w
         if (con->minibuffer_mode)
             minibuffer_redraw(con, row_pointer);
         else
-            screen_redraw(con, WHOLE);
+            screen_damage(con, 0, SCREEN_END);
     }
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline* editor_move_end_of_line(container *con, readline *row_pointer, wint_t unichar) {
     CURSOR = LINE_END;
-    if (LINE_END >= get_window_width()) {
-        HPADDING = LINE_END - get_window_width() + 1;
+    if (COLUMN >= term_width()) {
+        HPADDING = COLUMN - term_width() + 1;
         if (con->minibuffer_mode)
             minibuffer_redraw(con, row_pointer);
         else
-            screen_redraw(con, WHOLE);      
+            screen_damage(con, 0, SCREEN_END);      
     }
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
@@ -567,9 +729,9 @@ readline *editor_move_next_line(container *con, readline *row_pointer, wint_t un
     if (con->minibuffer_mode) return row_pointer;
     if (CUR_ROW == MAX_ROW - 1) return row_pointer;
     CUR_ROW++;
-    row_pointer = &con->rows[CUR_ROW];
+    row_pointer = container_row(con, CUR_ROW);
     char redraw = FALSE;
-    if (CUR_ROW - VPADDING == get_window_height() - 1) {
+    if (CUR_ROW - VPADDING == term_height() - 1) {
         VPADDING++;
         redraw = TRUE;
     }
@@ -579,7 +741,7 @@ readline *editor_move_next_line(container *con, readline *row_pointer, wint_t un
     }    
     CURSOR = 0;
     if (redraw) editor_page_center_cursor(con, row_pointer, unichar);
-    else        screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    else        screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
@@ -587,7 +749,7 @@ readline *editor_move_previous_line(container *con, readline *row_pointer, wint_
     if (con->minibuffer_mode) return row_pointer;
     if (CUR_ROW == 0) return row_pointer;
     CUR_ROW--;
-    row_pointer = &con->rows[CUR_ROW];
+    row_pointer = container_row(con, CUR_ROW);
     char redraw = FALSE;
     if (CUR_ROW + 1 == VPADDING) {
         VPADDING--;
@@ -599,31 +761,31 @@ readline *editor_move_previous_line(container *con, readline *row_pointer, wint_
     }
     CURSOR = 0;
     if (redraw) editor_page_center_cursor(con, row_pointer, unichar);
-    else        screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    else        screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline *editor_page_down(container *con, readline *row_pointer, wint_t unichar) {
     if (con->minibuffer_mode) return row_pointer;
-    int next = CUR_ROW + get_window_height() - 1;
+    int next = CUR_ROW + term_height() - 1;
     if (next >= MAX_ROW) next = MAX_ROW - 1;
     CUR_ROW = next;
-    row_pointer = &con->rows[CUR_ROW];
+    row_pointer = container_row(con, CUR_ROW);
     VPADDING = next;
-    screen_redraw(con, WHOLE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_damage(con, 0, SCREEN_END);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline *editor_page_up(container *con, readline *row_pointer, wint_t unichar) {
     if (con->minibuffer_mode) return row_pointer;
-    int next = CUR_ROW - get_window_height() + 1;
+    int next = CUR_ROW - term_height() + 1;
     if (next < 0) next = 0;
     CUR_ROW = next;
-    row_pointer = &con->rows[CUR_ROW];
+    row_pointer = container_row(con, CUR_ROW);
     VPADDING = next;
-    screen_redraw(con, WHOLE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_damage(con, 0, SCREEN_END);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
@@ -631,28 +793,29 @@ readline *editor_goto_beginning_of_document(container *con, readline *row_pointe
     if (con->minibuffer_mode) return row_pointer;
     CUR_ROW = 0;
     VPADDING = 0;
-    row_pointer = &con->rows[CUR_ROW];
+    row_pointer = container_row(con, CUR_ROW);
     CURSOR = 0;
-    screen_redraw(con, WHOLE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_damage(con, 0, SCREEN_END);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
 readline *editor_goto_end_of_document(container *con, readline *row_pointer, wint_t unichar) {
     if (con->minibuffer_mode) return row_pointer;
+    editor_load_wait(con);
     CUR_ROW = MAX_ROW - 1;
     VPADDING = CUR_ROW;
-    row_pointer = &con->rows[CUR_ROW];
+    row_pointer = container_row(con, CUR_ROW);
     CURSOR = LINE_END;
     editor_page_center_cursor(con, row_pointer, unichar);
     return row_pointer;
 }
 readline *editor_page_center_cursor(container *con, readline *row_pointer, wint_t unichar) {
     if (con->minibuffer_mode) return row_pointer;
-    VPADDING = CUR_ROW - get_window_height() / 2;
+    VPADDING = CUR_ROW - term_height() / 2;
     if (VPADDING < 0) VPADDING = 0;
-    screen_redraw(con, WHOLE);
-    screen_set_cursor(CUR_ROW, CURSOR, HPADDING, VPADDING);
+    screen_damage(con, 0, SCREEN_END);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
     return row_pointer;
 }
 
@@ -660,45 +823,407 @@ void editor_goto_line(container *con, char message[]) {
     int line_number = strtol(message, NULL, 10);
     if (line_number == 0) return;
     if (line_number < 1)       line_number = 1;
+    if (line_number > MAX_ROW) editor_load_wait(con);
     if (line_number > MAX_ROW) line_number = MAX_ROW;
     con->current_row = line_number - 1;
-    editor_page_center_cursor(con, &con->rows[con->current_row], 0);
+    editor_page_center_cursor(con, container_row(con, con->current_row), 0);
 }
 
-void editor_search_forward(container *con, char message[]) {
-    int char_count  = 0;
-    int cursor      = 0;
-    int message_len = 0;
-    readline *row_pointer;
+/*-----------------------------------------------  
+    incremental search
+ -----------------------------------------------*/
+
+/* move the cursor of the document to match, scrolling if needed */
+void isearch_show(container *con, search_match *match) {
+    readline *row_pointer = container_row(con, match->row);
+    CURSOR = match->cursor;
+    con->temp_row = match->row;
+    if (match->row < VPADDING || match->row >= VPADDING + term_height() - 1) {
+        VPADDING = match->row - term_height() / 2;
+        if (VPADDING < 0) VPADDING = 0;
+        /* the minibuffer stays on the last line */
+        CUR_ROW = VPADDING + term_height() - 1;
+    }
+    int width = term_width() - 1;
+    if (COLUMN < con->temp_hpadding || COLUMN >= con->temp_hpadding + width)
+        con->temp_hpadding = COLUMN < width ? 0 : COLUMN - width / 2;
+    screen_damage(con, 0, SCREEN_END);
+}
+
+/* the prompt tells whether the query is found */
+void isearch_prompt(container *con, readline *row_pointer, int failing) {
+    if (con->search.failing == failing) return;
+    con->search.failing = failing;
+    if (con->search.regexp)
+        infobar_print(con, failing ? "Failing regexp: " : "Regexp I-search:");
+    else
+        infobar_print(con, failing ? "Failing: " : "I-search:");
+    minibuffer_redraw(con, row_pointer);
+    screen_set_cursor(CUR_ROW, COLUMN, HPADDING, VPADDING);
+}
+
+/* the next match of the query at or after (row, from), through the
+ * trigram index or on all processors when the document is large */
+int isearch_forward(container *con, int row, int from, search_match *match) {
+    isearch *search = &con->search;
+    if (!search->regexp && trigram_usable(&con->index, &search->pattern))
+        return trigram_forward(&con->index, &search->pattern, row, from, match);
+    parallel_query query;
+    query.pattern       = search->regexp ? NULL : &search->pattern;
+    query.re            = search->re;
+    query.regexp        = search->query;
+    query.regexp_length = search->query_length;
+    query.fold          = TRUE;
+    if (search->regexp && search->re == NULL) return 0;
+    return parallel_forward(&query, con->rows, MAX_ROW, row, from, match);
+}
+
+/* the previous match of the query before (row, before) */
+int isearch_backward(container *con, int row, int before, search_match *match) {
+    isearch *search = &con->search;
+    if (search->regexp)
+        return search->re != NULL
+               && regex_backward(search->re, con->rows, MAX_ROW, row, before, match);
+    return search_backward(&search->pattern, con->rows, MAX_ROW, row, before, match);
+}
+
+/* the cached matches restart with match */
+void isearch_reset_matches(isearch *search, search_match *match) {
+    if (search->match_capacity == 0) {
+        search->match_capacity = 64;
+        search->matches = malloc(sizeof(search_match) * search->match_capacity);
+    }
+    search->matches[0]  = *match;
+    search->match_count = 1;
+    search->current     = 0;
+}
+
+void editor_isearch_begin(container *con, int forward, int regexp) {
+    isearch *search = &con->search;
+    readline *row_pointer = container_row(con, con->temp_row);
+    search->active         = TRUE;
+    search->forward        = forward;
+    search->regexp         = regexp;
+    search->re             = NULL;
+    search->failing        = FALSE;
+    search->query_length   = 0;
+    search->match_count    = 0;
+    search->start.row      = con->temp_row;
+    search->start.cursor   = CURSOR;
+    search->start_vpadding = VPADDING;
+    search->start_hpadding = con->temp_hpadding;
+    search->history[0]     = search->start;
+    search->known[0]       = TRUE;
+    search_compile(&search->pattern, NULL, 0, TRUE);
+}
+
+/* Follow the query in the minibuffer after each key. A longer query
+ * continues from the match of its prefix, a shorter one goes back to
+ * the match it had before. A regexp can match where its prefix does
+ * not, it is always searched from where the search began. */
+void editor_isearch_update(container *con, readline *minibuffer) {
+    isearch *search = &con->search;
+    wint_t query[MINIBUFFER_LIMIT];
+    int length = minibuffer->line_end - minibuffer->margin;
+    if (length > MINIBUFFER_LIMIT) length = MINIBUFFER_LIMIT;
+    row_copy_out(minibuffer, minibuffer->margin, length, query);
+    int common = 0;
+    while (common < length && common < search->query_length
+           && query[common] == search->query[common]) common++;
+    if (common == length && length == search->query_length) return;
+
+    for (int k = common + 1; k <= search->query_length; k++)
+        search->known[k] = FALSE;
+    memcpy(search->query, query, sizeof(wint_t) * length);
+    search->query_length = length;
+    search_free(&search->pattern);
+    regex_free(search->re);
+    search->re = NULL;
+    if (search->regexp) {
+        /* an incomplete regexp fails until it is valid */
+        const char *error;
+        search->re = regex_compile(query, length, TRUE, &error);
+    } else {
+        search_compile(&search->pattern, query, length, TRUE);
+    }
+    search->match_count = 0;
+
+    /* the longest prefix of the query with a known result, a row of -1
+     * marks a failing query */
+    int k = search->regexp ? 0 : length;
+    while (!search->known[k]) k--;
+    search_match match = search->history[k];
+    int found = match.row >= 0;
+    if (found && k < length) {
+        if (search->forward)
+            found = isearch_forward(con, match.row, match.cursor, &match);
+        else
+            found = isearch_backward(con, match.row, match.cursor + (k > 0), &match);
+    }
+    search->known[length] = TRUE;
+    if (found) {
+        search->history[length] = match;
+        isearch_reset_matches(search, &match);
+        isearch_show(con, &match);
+    } else {
+        search->history[length].row = -1;
+    }
+    isearch_prompt(con, minibuffer, !found && length > 0);
+    screen_damage(con, 0, SCREEN_END);
+}
+
+/* C-s and C-r while searching: go to the next or previous match, an
+ * empty query repeats the last search */
+void editor_isearch_step(container *con, readline *minibuffer, int forward) {
+    isearch *search = &con->search;
+    search->forward = forward;
+    if (search->query_length == 0) {
+        if (search->last_length == 0) return;
+        row_insert_n(minibuffer, minibuffer->line_end,
+                     search->last_query, search->last_length);
+        minibuffer->cursor = minibuffer->line_end;
+        minibuffer_redraw(con, minibuffer);
+        editor_isearch_update(con, minibuffer);
+        return;
+    }
+    search_match match;
+    int found;
+    if (search->match_count == 0 || search->failing) {
+        /* a failing search starts over at the other end */
+        if (forward)
+            found = isearch_forward(con, 0, 0, &match);
+        else
+            found = isearch_backward(con, MAX_ROW, 0, &match);
+        if (found) isearch_reset_matches(search, &match);
+    } else if (forward) {
+        found = search->current + 1 < search->match_count;
+        if (!found) {
+            match = search->matches[search->match_count - 1];
+            found = isearch_forward(con, match.row, match.cursor + 1, &match);
+            if (found) {
+                if (search->match_count == search->match_capacity) {
+                    search->match_capacity *= 2;
+                    search->matches = realloc(search->matches,
+                            sizeof(search_match) * search->match_capacity);
+                }
+                search->matches[search->match_count++] = match;
+            }
+        }
+        if (found) search->current++;
+    } else {
+        found = search->current > 0;
+        if (!found) {
+            match = search->matches[0];
+            found = isearch_backward(con, match.row, match.cursor, &match);
+            if (found) {
+                if (search->match_count == search->match_capacity) {
+                    search->match_capacity *= 2;
+                    search->matches = realloc(search->matches,
+                            sizeof(search_match) * search->match_capacity);
+                }
+                memmove(&search->matches[1], search->matches,
+                        sizeof(search_match) * search->match_count);
+                search->matches[0] = match;
+                search->match_count++;
+                search->current++;
+            }
+        }
+        if (found) search->current--;
+    }
+    if (found) {
+        match = search->matches[search->current];
+        search->history[search->query_length] = match;
+        isearch_show(con, &match);
+    }
+    isearch_prompt(con, minibuffer, !found);
+}
+
+/* leave the search, the cursor stays where it is */
+void isearch_end(container *con) {
+    isearch *search = &con->search;
+    memcpy(search->last_query, search->query, sizeof(wint_t) * search->query_length);
+    search->last_length = search->query_length;
+    search_free(&search->pattern);
+    regex_free(search->re);
+    search->re          = NULL;
+    search->active      = FALSE;
+    search->match_count = 0;
+    screen_damage(con, 0, SCREEN_END);
+}
+
+/* C-g: back to where the search began */
+void editor_isearch_cancel(container *con) {
+    isearch *search = &con->search;
+    readline *row_pointer = container_row(con, search->start.row);
+    CURSOR              = search->start.cursor;
+    con->temp_row       = search->start.row;
+    con->temp_hpadding  = search->start_hpadding;
+    VPADDING            = search->start_vpadding;
+    isearch_end(con);
+}
+
+/* RET: minibuffer callback */
+void editor_isearch_finish(container *con, char message[]) {
+    isearch_end(con);
+    screen_restore_cursor(con);
+}
+
+/*-----------------------------------------------  
+    regexp replace
+ -----------------------------------------------*/
+
+/* first prompt of M-%: the pattern is kept for the second one */
+void editor_replace_compile(container *con, char message[]) {
+    wchar_t pattern[MINIBUFFER_LIMIT];
+    int length = mbstowcs(pattern, message, MINIBUFFER_LIMIT);
+    const char *error = "Empty regexp";
+    regex_free(con->replace);
+    con->replace = NULL;
+    if (length > 0)
+        con->replace = regex_compile((wint_t *) pattern, length, FALSE, &error);
+    if (con->replace == NULL) {
+        errno = 0;
+        infobar_error(con, (char *) error);
+    }
+}
+
+/* C-g between the prompts */
+void editor_replace_cancel(container *con) {
+    regex_free(con->replace);
+    con->replace = NULL;
+}
 
-    /* convert char array to wide char array */
-    wchar_t wmessage[MINIBUFFER_LIMIT];
-    mbstowcs(wmessage, message, MINIBUFFER_LIMIT);
-    
-    /* get message length */
-    while(wmessage[char_count] != 0) char_count++;
-    message_len = char_count;
-    char_count = 0;
-    
-    for (int i = CUR_ROW; i < MAX_ROW; i++) {
-        row_pointer = &con->rows[i];
-        for(int j = (i == CUR_ROW) ? CURSOR+1 : 0; j < LINE_END; j++) {
-            if (towlower(BUFFER[j]) == towlower(wmessage[char_count])) {
-                if (char_count == 0) cursor = j;
-                char_count++;
-                if (char_count == message_len) {
-                    CUR_ROW = i;
-                    CURSOR  = cursor;
-                    infobar_print(con, "found\0");
-                    editor_page_center_cursor(con, row_pointer, 0);
-                    return;
+/* Second prompt of M-%: replace every match from the cursor to the end
+ * of the document, "\&" in the replacement stands for the match. An
+ * empty match right after a replacement is skipped. */
+void editor_replace_regexp(container *con, char message[]) {
+    regex *re = con->replace;
+    con->replace = NULL;
+    if (re == NULL) return;
+    editor_load_wait(con);
+    wchar_t with[MINIBUFFER_LIMIT];
+    int with_length = mbstowcs(with, message, MINIBUFFER_LIMIT);
+    if (with_length < 0) with_length = 0;
+
+    struct timespec begin, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    wint_t *text     = NULL;
+    int     capacity = 0;
+    int     count    = 0;
+    double  scanned  = 0;
+    int    *found    = NULL;
+    int     found_capacity = 0;
+    int     from     = container_row(con, CUR_ROW)->cursor;
+    line_iter iter;
+    readline *row_pointer = lines_iter_start(con->rows, CUR_ROW, &iter);
+    for (int r = CUR_ROW; r < MAX_ROW; r++, row_pointer = lines_iter_next(&iter)) {
+        /* the matches of the row are found in one pass before the row
+         * changes, an empty match right behind the last one is skipped */
+        int start, end;
+        int after = -1;
+        int n     = 0;
+        scanned += LINE_END - from + 1;
+        regex_row(re, row_pointer);
+        while (from <= LINE_END && regex_next(re, from, &start, &end)) {
+            if (start == end && start == after) {
+                from = start + 1;
+                continue;
+            }
+            if (2 * n + 2 > found_capacity) {
+                found_capacity = 4 * (n + 1);
+                found = realloc(found, sizeof(int) * found_capacity);
+            }
+            found[2*n]   = start;
+            found[2*n+1] = end;
+            n++;
+            from = after = end;
+        }
+        /* the replacements so far moved the rest of the row by shift */
+        int shift = 0;
+        for (int m = 0; m < n; m++) {
+            start = found[2*m] + shift;
+            end   = found[2*m+1] + shift;
+            int length = 0;
+            for (int i = 0; i < with_length; i++) {
+                if (length + (end - start) + 1 > capacity) {
+                    capacity = 2 * (length + (end - start) + 1);
+                    text = realloc(text, sizeof(wint_t) * capacity);
+                }
+                if (with[i] == '\\' && i + 1 < with_length && with[i+1] == '&') {
+                    row_copy_out(row_pointer, start, end - start, text + length);
+                    length += end - start;
+                    i++;
+                } else if (with[i] == '\\' && i + 1 < with_length && with[i+1] == '\\') {
+                    text[length++] = '\\';
+                    i++;
+                } else {
+                    text[length++] = with[i];
                 }
-            } else {
-                char_count = 0;
             }
+            container_record_row(con, UNDO_DELETE, r, row_pointer, start, end - start);
+            container_record(con, UNDO_INSERT, r, start, text, length);
+            row_delete(row_pointer, start, end - start);
+            row_insert_n(row_pointer, start, text, length);
+            shift += length - (end - start);
+            count++;
         }
+        if (n > 0) container_touch_row(con, r);
+        from = 0;
+    }
+    free(found);
+    free(text);
+    regex_free(re);
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double seconds = (end_time.tv_sec - begin.tv_sec)
+                     + (end_time.tv_nsec - begin.tv_nsec) / 1e9;
+    char status[MINIBUFFER_LIMIT];
+    sprintf(status, "Replaced %d occurrences in %.3f s (%.0f MB/s)",
+            count, seconds, seconds > 0 ? scanned / 1e6 / seconds : 0);
+    screen_damage(con, 0, SCREEN_END);
+    infobar_print(con, status);
+}
+
+
+/* M-c: count the matches of a regexp from the cursor to the end of
+ * the document */
+void editor_count_matches(container *con, char message[]) {
+    wchar_t pattern[MINIBUFFER_LIMIT];
+    int length = mbstowcs(pattern, message, MINIBUFFER_LIMIT);
+    const char *error = "Empty regexp";
+    regex *re = length > 0
+                ? regex_compile((wint_t *) pattern, length, FALSE, &error) : NULL;
+    if (re == NULL) {
+        errno = 0;
+        infobar_error(con, (char *) error);
+        return;
     }
-    infobar_print(con, "not found\0");
+    editor_load_wait(con);
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    parallel_query query;
+    query.pattern       = NULL;
+    query.re            = re;
+    query.regexp        = (wint_t *) pattern;
+    query.regexp_length = length;
+    query.fold          = FALSE;
+    readline *row_pointer = container_row(con, CUR_ROW);
+    long total = parallel_count(&query, con->rows, MAX_ROW, CUR_ROW, CURSOR);
+    regex_free(re);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    char status[MINIBUFFER_LIMIT];
+    sprintf(status, "%ld matches in %.3f s", total, seconds);
+    infobar_print(con, status);
+}
+
+
+/* C-x t: turn the trigram index on or off */
+void editor_toggle_index(container *con) {
+    if (con->index.enabled) trigram_stop(&con->index);
+    else                    trigram_start(&con->index);
+    infobar_print_index(con);
 }
 
 
@@ -706,78 +1231,196 @@ void editor_search_forward(container *con, char message[]) {
     file operations
  -----------------------------------------------*/
 
+/* The document is written in the background from a snapshot, edits
+ * made in the meantime go into the next save. */
 void editor_save_file(container *con, char filename[]) {
-    FILE *write_fp;
-    write_fp = fopen(filename, "w, utf-8");
-    if(write_fp == NULL) {
+    editor_load_wait(con);
+    editor_save_wait(con);
+    journal_mark(&con->journal);
+    save_start(&con->save, con->rows, MAX_ROW, filename, SAVE_FSYNC,
+               &con->index.lock);
+    infobar_print(con, "Saving...");
+    editor_save_progress(con);
+}
+
+/* reports the end of a save, the name is kept once it worked */
+void editor_save_progress(container *con) {
+    save_job *job = &con->save;
+    if (!job->saving || !job->done || con->minibuffer_mode) return;
+    int   error = job->error;
+    char *name  = strdup(job->filename);
+    save_finish(job);
+    if (error) {
+        free(name);
+        errno = error;
         infobar_error(con, "Could not write file");
         return;
     }
-    for (int i = 0; i < con->max_row; i++) {
-        /* CR ist not in [0, LINE_END] */
-        for (int j = 0; j <= con->rows[i].line_end; j++) { 
-            if (con->rows[i].buffer[j] == 0) break;
-            if (con->rows[i].buffer[j] != TAB_PAD_CHAR)
-                fwprintf(write_fp, L"%lc", con->rows[i].buffer[j]);
-        }
+    /* the journal keeps the edits made since the save started, a new
+     * file gets its journal with the first save */
+    if (con->journal.open) {
+        journal_compact(&con->journal, name);
+    } else {
+        journal_open(&con->journal, name);
+        journal_replayed(&con->journal, FALSE);
     }
-    fclose(write_fp);
-    con->buffer_filename = strdup(filename);
+    free(con->buffer_filename);
+    con->buffer_filename = name;
     infobar_print(con, "document saved\0");
 }
 
+/* waits for the save under way, before another one or quitting */
+void editor_save_wait(container *con) {
+    if (!con->save.saving) return;
+    save_wait(&con->save);
+    editor_save_progress(con);
+}
+
 void editor_load_file(container *con, char filename[]) {
-    FILE *read_fp;
-    wint_t unichar;
-    readline *row_pointer;
+    int fd;
     /* file does exist */
     if(access(filename, R_OK) != -1) {
-        read_fp = fopen(filename, "r, utf-8");
-        if (read_fp == NULL) infobar_error(con, "Could not load file");
-        row_pointer = &con->rows[CUR_ROW];
-        make_new_row(row_pointer);
+        fd = open(filename, O_RDONLY);
+        if (fd == -1) {
+            container_insert_row(con, CUR_ROW);
+            infobar_error(con, "Could not load file");
+            return;
+        }
     /* file does not exist */
     } else {
-        row_pointer = &con->rows[CUR_ROW];
-        make_new_row(row_pointer);
+        container_insert_row(con, CUR_ROW);
+        editor_recover(con, filename);
         return;
     }
-    while ((unichar = fgetwc(read_fp)) != EOF) {
-        /* handle carriage return */
-        if (unichar == 0xA) {
-            BUFFER[CURSOR] = unichar;
-            CUR_ROW++;
-            MAX_ROW++;
-            CURSOR = 0;
-            if (MAX_ROW  == con->row_length) extend_container(con);
-            row_pointer = &con->rows[CUR_ROW];
-            make_new_row(row_pointer);
-            continue;
+    /* Only the first screen is loaded before it is drawn, the rest of
+     * the file follows in the background. */
+    struct stat st;
+    size_t length = fstat(fd, &st) == 0 && st.st_size > 0 ? st.st_size : 0;
+    const char *env = getenv("MX_MAP_SIZE");
+    long map_size = env ? atol(env) << 20 : LOAD_MAP_SIZE;
+    if (length == 0 || length < map_size
+        || !load_map(&con->load, fd, length, term_height()))
+        load_read(&con->load, fd, length, term_height());
+    screen_damage(con, 0, SCREEN_END);
+    screen_set_cursor(0,0,0,0);
+    editor_load_progress(con);
+    editor_recover(con, filename);
+}
+
+/* Replays the journal a session that did not quit cleanly left for the
+ * file. The edits are applied to the whole document, so the rest of
+ * the file is loaded first. Replay stops at the first edit that does
+ * not fit the document, the journal is cut off there. */
+/* copy the length characters from (row, cursor) that
+ * container_delete_text would remove, newlines included */
+static int recover_copy(container *con, int row, int cursor, int length,
+                        wint_t *text) {
+    int n = 0;
+    readline *row_pointer = container_row(con, row);
+    while (row_pointer != NULL && n < length) {
+        int take = row_pointer->line_end - cursor;
+        if (take > length - n) take = length - n;
+        row_copy_out(row_pointer, cursor, take, text + n);
+        n += take;
+        if (n == length) break;
+        text[n++] = '\n';
+        row_pointer = container_row(con, ++row);
+        cursor = 0;
+    }
+    return n;
+}
+
+void editor_recover(container *con, char filename[]) {
+    journal *j = &con->journal;
+    journal_open(j, filename);
+    if (j->replay == NULL) {
+        journal_replayed(j, FALSE);
+        return;
+    }
+    editor_load_wait(con);
+    journal_entry e;
+    int count = 0, rejected = FALSE;
+    /* the recovered edits are one undo step, the journal already has them */
+    undo_command(&con->undo);
+    while (journal_next(j, &e)) {
+        readline *row_pointer = e.row < MAX_ROW ? container_row(con, e.row) : NULL;
+        if (row_pointer == NULL || e.cursor > row_pointer->line_end) {
+            rejected = TRUE;
+            break;
         }
-        /* handle tabs */
-        if (unichar == 0x9) {
-            BUFFER[CURSOR] = unichar;
-            CURSOR++;
-            LINE_END++;
-            int next_tab_stop = ((CURSOR-1)/TAB_STOP_WIDTH) * TAB_STOP_WIDTH + TAB_STOP_WIDTH;
-            for(int i = CURSOR; i < next_tab_stop; i++) {
-                BUFFER[CURSOR] = TAB_PAD_CHAR;
-                CURSOR++;
-                LINE_END++;
-                if (LINE_END >= LINE_LEN) extend_row(row_pointer);
-            }
-            continue;
+        if (e.kind == UNDO_INSERT) {
+            int end_row, end_cursor;
+            undo_record(&con->undo, UNDO_INSERT, e.row, e.cursor, e.text, e.length);
+            container_insert_text(con, e.row, e.cursor, e.text, e.length,
+                                  &end_row, &end_cursor);
+        } else {
+            wint_t *text = malloc(e.length * sizeof(wint_t));
+            int n = recover_copy(con, e.row, e.cursor, e.length, text);
+            undo_record(&con->undo, e.kind, e.row, e.cursor, text, n);
+            free(text);
+            container_delete_text(con, e.row, e.cursor, e.length);
         }
-        /* everything else */
-        BUFFER[CURSOR] = unichar;
-        CURSOR++;
-        LINE_END++;
-        if (LINE_END >= LINE_LEN) extend_row(row_pointer);
+        count++;
     }
-    CURSOR = 0;
-    fclose(read_fp);
-    screen_redraw(con, WHOLE);
-    screen_set_cursor(0,0,0,0);
+    /* typing after the recovery does not join its last run */
+    undo_command(&con->undo);
+    journal_replayed(j, rejected);
+    screen_damage(con, 0, SCREEN_END);
+    char message[MINIBUFFER_LIMIT];
+    snprintf(message, MINIBUFFER_LIMIT, "Recovered %d edits from %s, C-/ undoes them", count, j->path);
+    infobar_print(con, message);
+}
+
+/* Reports how far the load has come and draws the rows that arrived
+ * since the last report. Once the file is complete the statistics are
+ * shown and a large document gets its index. */
+void editor_load_progress(container *con) {
+    file_load *l = &con->load;
+    if (!l->loading) return;
+    if (l->loaded != l->shown) {
+        screen_damage(con, 0, SCREEN_END);
+        l->shown = l->loaded;
+    }
+    char message[MINIBUFFER_LIMIT];
+    if (!load_finish(l)) {
+        if (con->minibuffer_mode) return;
+        if (l->length > 0)
+            sprintf(message, "Loading %.0f%%, %d lines",
+                    100.0 * l->loaded / l->length, MAX_ROW);
+        else
+            sprintf(message, "Loading %.1f MB, %d lines", l->loaded / 1e6, MAX_ROW);
+        infobar_print(con, message);
+        return;
+    }
+    if (l->error) {
+        errno = l->error;
+        infobar_error(con, "Could not load file");
+        return;
+    }
+    if (l->mapped) {
+        sprintf(message, "Mapped %.1f MB, %d lines in %.3f s",
+                l->loaded / 1e6, MAX_ROW, l->seconds);
+    } else {
+        sprintf(message, "Loaded %.1f MB, %d lines in %.3f s (%.0f MB/s)",
+                l->loaded / 1e6, MAX_ROW, l->seconds,
+                l->seconds > 0 ? l->loaded / 1e6 / l->seconds : 0);
+        /* small files are searched fast enough without an index */
+        if (l->loaded >= TRIGRAM_MIN_SIZE) {
+            trigram_start(&con->index);
+            strcat(message, ", indexing");
+        }
+    }
+    if (!con->minibuffer_mode) infobar_print(con, message);
+}
+
+/* Commands that need the end of the document wait for the rest of the
+ * file. */
+void editor_load_wait(container *con) {
+    if (!con->load.loading) return;
+    if (!con->minibuffer_mode) infobar_print(con, "Loading the rest of the file...");
+    term_flush();
+    load_wait(&con->load);
+    editor_load_progress(con);
 }
 
 /*-----------------------------------------------  
@@ -786,42 +1429,69 @@ void editor_load_file(container *con, char filename[]) {
 
 void infobar_print(container *con, char status_message[]) {
     infobar_erase(con);
-    screen_set_cursor(get_window_height()-1, 0, 0, 0);
+    screen_set_cursor(term_height()-1, 0, 0, 0);
     ANSI_INVERT_COLOR;
-    printf("%.*s", get_window_width()-1, status_message);
+    term_printf("%.*s", term_width()-1, status_message);
     ANSI_REVERT_INVERT_COLOR;
-    screen_set_cursor(con->current_row, con->rows[con->current_row].cursor,
-                      con->hpadding, con->vpadding);
+    screen_restore_cursor(con);
 }
 void infobar_error(container *con, char status_message[]) {
-    screen_set_cursor(get_window_height()-1, 0, 0, 0);
+    screen_set_cursor(term_height()-1, 0, 0, 0);
     ANSI_KILL_LINE;
     ANSI_INVERT_COLOR;
-    if(errno) printf("ERROR: %.*s", get_window_width()-8, strerror(errno));
-    else      printf("ERROR: %.*s", get_window_width()-8, status_message);
+    if(errno) term_printf("ERROR: %.*s", term_width()-8, strerror(errno));
+    else      term_printf("ERROR: %.*s", term_width()-8, status_message);
     ANSI_REVERT_INVERT_COLOR;
-    screen_set_cursor(con->current_row, con->rows[con->current_row].cursor,
-                      con->hpadding, con->vpadding);
+    screen_restore_cursor(con);
+}
+/* C-x i: memory and build time of the trigram index */
+void infobar_print_index(container *con) {
+    char message[MINIBUFFER_LIMIT];
+    long memory;
+    int  indexed, leaves;
+    if (!con->index.enabled) {
+        infobar_print(con, "Index off\0");
+        return;
+    }
+    trigram_stats(&con->index, &memory, &indexed, &leaves);
+    if (con->index.built)
+        sprintf(message, "Index: %d/%d leaves, %.1f MB, built in %.3f s",
+                indexed, leaves, memory / 1e6, con->index.seconds);
+    else
+        sprintf(message, "Index: %d/%d leaves, %.1f MB, building",
+                indexed, leaves, memory / 1e6);
+    infobar_print(con, message);
+}
+/* C-x m: memory of the rows, slack is lost to the size classes,
+ * fragmentation is reserved memory that holds no row */
+void infobar_print_memory(container *con) {
+    char message[MINIBUFFER_LIMIT];
+    slab_stats stats = slab_get_stats();
+    sprintf(message, "Rows: %.1f MB used, %.1f MB reserved, %.1f MB slack, "
+            "%.0f%% fragmented, %ld pages, %ld text blocks",
+            stats.used / 1e6, stats.reserved / 1e6, stats.slack / 1e6,
+            stats.reserved > 0 ? 100.0 * (stats.reserved - stats.used) / stats.reserved : 0,
+            stats.pages, stats.text_blocks);
+    infobar_print(con, message);
 }
 void infobar_print_position(container *con) {
-    screen_set_cursor(get_window_height()-1, 0, 0, 0);
-    readline *row_pointer = &con->rows[CUR_ROW];
+    screen_set_cursor(term_height()-1, 0, 0, 0);
+    readline *row_pointer = container_row(con, CUR_ROW);
     char message[80];
     sprintf(message, "CHAR: (%lc, %d, 0x%x) ROW: %d COLUMN: %d",
-           BUFFER[CURSOR], BUFFER[CURSOR], BUFFER[CURSOR], CUR_ROW+1, CURSOR+1);
+           row_get(row_pointer, CURSOR), row_get(row_pointer, CURSOR),
+           row_get(row_pointer, CURSOR), CUR_ROW+1, COLUMN+1);
     ANSI_KILL_LINE;
     ANSI_INVERT_COLOR;
-    printf("%.*s", get_window_width(), message);
+    term_printf("%.*s", term_width(), message);
     ANSI_REVERT_INVERT_COLOR;
-    screen_set_cursor(con->current_row, con->rows[con->current_row].cursor,
-                      con->hpadding, con->vpadding);
+    screen_restore_cursor(con);
 }
 
 void infobar_erase(container *con) {
-    screen_set_cursor(get_window_height(), 0, 0, 0);
+    screen_set_cursor(term_height(), 0, 0, 0);
     ANSI_KILL_LINE;
-    screen_set_cursor(con->current_row, con->rows[con->current_row].cursor,
-                      con->hpadding, con->vpadding);
+    screen_restore_cursor(con);
 }
 
 /*-----------------------------------------------  
@@ -829,15 +1499,17 @@ void infobar_erase(container *con) {
  -----------------------------------------------*/
 
 void activate_minibuffer(container *con, readline *row_pointer, int margin) {
+    /* the prompt occupies the first margin cells of the line */
+    row_truncate(row_pointer, 0);
+    while (LINE_END < margin) row_insert(row_pointer, LINE_END, 0);
     MARGIN = margin;
     CURSOR = margin;
-    LINE_END = margin;
     con->temp_hpadding = HPADDING;
     HPADDING = 0;
     con->temp_row = CUR_ROW;
     con->minibuffer_mode = TRUE;
-    screen_set_cursor(get_window_height()-1, margin, 0, 0);
-    CUR_ROW = VPADDING + get_window_height()-1;
+    screen_set_cursor(term_height()-1, margin, 0, 0);
+    CUR_ROW = VPADDING + term_height()-1;
     ANSI_KILL_LINE;
 }
 
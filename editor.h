@@ -18,30 +18,44 @@
 #ifndef EDITOR_GUARD
 #define EDITOR_GUARD
 
-#include <sys/ioctl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h> 
 #include <string.h>
 #include <wchar.h>
 #include <wctype.h>
-#include <termios.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "row.h"
+#include "lines.h"
+#include "save.h"
+#include "term.h"
+#include "render.h"
+#include "search.h"
+#include "regex.h"
+#include "parallel.h"
+#include "trigram.h"
+#include "undo.h"
+#include "input.h"
+#include "load.h"
+#include "journal.h"
 
 #define TRUE  1
 #define FALSE 0
 
 #define DEBUG FALSE
 
-#define LINE_BLOCK_SIZE  100
-#define ROW_BLOCK_SIZE   100 /* has to be greater than 1 */
 #define MINIBUFFER_LIMIT 300
+#define SCREEN_END       INT_MAX
 
 #define LINE_LEN  row_pointer->line_length
 #define CURSOR    row_pointer->cursor
 #define LINE_END  row_pointer->line_end
-#define BUFFER    row_pointer->buffer
 #define MARGIN    row_pointer->margin
+#define COLUMN    row_column(row_pointer, row_pointer->cursor)
 #define CUR_ROW   con->current_row
 #define MAX_ROW   con->max_row
 #define HPADDING  con->hpadding
@@ -49,68 +63,109 @@
 
 #define CURSOR_PREV   row_pointer_prev->cursor
 #define LINE_END_PREV row_pointer_prev->line_end
-#define BUFFER_PREV   row_pointer_prev->buffer
 
 #define KEY_CTRL       -96
 #define KEY_BACKSPACE  127
 #define KEY_ALT         27
 #define KEY_TAB          9
 #define KEY_ENTER       10
-#define BRACKETLEFT     91
+#define KEY_UNDO        31  /* C-/ and C-_ */
 
-#define ANSI_RESET_SCREEN        printf("\033[2J\033[1;1H")
-#define ANSI_KILL_LINE           printf("\033[K")
-#define ANSI_INVERT_COLOR        printf("\033[7m")
-#define ANSI_REVERT_INVERT_COLOR printf("\033[27m")
+#define ANSI_RESET_SCREEN        term_puts("\033[2J\033[1;1H")
+#define ANSI_KILL_LINE           term_puts("\033[K")
+#define ANSI_INVERT_COLOR        term_puts("\033[7m")
+#define ANSI_REVERT_INVERT_COLOR term_puts("\033[27m")
+#define ANSI_PASTE_ON            term_puts("\033[?2004h")
+#define ANSI_PASTE_OFF           term_puts("\033[?2004l")
 
-/* Has to correlate to the tab width of the terminal
- * but this is not guaranteed if the user has set
- * the terminal tab with by himself. Should read
- * terminal tab width and set this value accordingly.
- */
-#define TAB_STOP_WIDTH   8
-#define TAB_PAD_CHAR    -9
+/* initial size of the buffer collecting a bracketed paste */
+#define PASTE_BLOCK_SIZE 4096
 
+/* keys applied at most before a frame is drawn */
+#define INPUT_BATCH 64
+
+/* milliseconds between two frames while a file loads or saves */
+#define LOAD_TICK 100
 
-enum draw_mode {
-    WHOLE,
-    REGION_DOWN,
-    REGION_UP,
-    LINE
-};
 
 enum callback_func {
     GOTO_FUNC,
     SAVE_FUNC,
-    SEARCHF_FUNC
+    ISEARCH_FUNC,
+    REPLACE_FUNC,
+    REPLACE_WITH_FUNC,
+    COUNT_FUNC
 };
 
-typedef struct readline {
-    int     cursor;
-    int     line_end;
-    wint_t *buffer;
-    int     line_length;
-    int     margin;
-} readline;
+/* State of an incremental search. The minibuffer holds the query, the
+ * cursor of the document moves from match to match. A regexp query is
+ * compiled into re, NULL while it is not valid. */
+typedef struct isearch {
+    char           active;
+    char           forward;
+    char           failing;
+    char           regexp;
+    search_pattern pattern;
+    regex         *re;
+    wint_t         query[MINIBUFFER_LIMIT];
+    int            query_length;
+    wint_t         last_query[MINIBUFFER_LIMIT];
+    int            last_length;
+    search_match   start;          /* cursor when the search began */
+    int            start_vpadding;
+    int            start_hpadding;
+    /* match for each length of the query, to go back on backspace */
+    search_match   history[MINIBUFFER_LIMIT + 1];
+    char           known[MINIBUFFER_LIMIT + 1];
+    /* consecutive matches of the query, there are no others in
+     * between, so that stepping through them needs no search */
+    search_match  *matches;
+    int            match_count;
+    int            match_capacity;
+    int            current;
+} isearch;
 
 typedef struct container {
-    readline *rows; 
+    line_node *rows; 
     int       current_row;
     int       max_row;
-    int       row_length; 
     int       hpadding;
     int       vpadding;
     char      minibuffer_mode;
     int       temp_row;
     int       temp_hpadding;
     char     *buffer_filename;
+    int       damage_from; /* rows to be compared by screen_render */
+    int       damage_to;
+    isearch   search;
+    regex    *replace;     /* pattern between the two prompts of M-% */
+    trigram_index index;
+    undo_log  undo;
+    file_load load;
+    save_job  save;
+    journal   journal;
 } container;
 
-void      screen_redraw                     (container*, enum draw_mode);
+void      screen_damage                     (container*, int, int);
+void      screen_render                     (container*);
+void      screen_restore_cursor             (container*);
 void      die                               (const char*);
-void      make_new_row                      (readline*);
+readline* container_row                     (container*, int);
+readline* container_insert_row              (container*, int);
+void      container_delete_row              (container*, int);
+void      container_change_row              (container*, int);
+void      container_touch_row               (container*, int);
+void      container_record                  (container*, int, int, int, const wint_t*, int);
+void      container_record_row              (container*, int, int, readline*, int, int);
+void      container_insert_text             (container*, int, int, const wint_t*, int, int*, int*);
+void      container_delete_text             (container*, int, int, int);
 void      editor_save_file                  (container*, char[]);
+void      editor_save_progress              (container*);
+void      editor_save_wait                  (container*);
 void      editor_load_file                  (container*, char[]);
+void      editor_load_progress              (container*);
+void      editor_load_wait                  (container*);
+void      editor_recover                    (container*, char[]);
 void      infobar_print                     (container*, char[]);
 void      infobar_error                     (container*, char[]);
 void      infobar_erase                     (container*);
@@ -118,6 +173,7 @@ void      infobar_print_position            (container*);
 readline* editor_newline                    (container*, readline*);
 readline* editor_insert_tab                 (container*, readline*);
 readline* editor_insert_char                (container*, readline*, wint_t);
+readline* editor_insert_string              (container*, readline*, const wint_t*, int);
 readline* editor_delete_char                (container*, readline*, wint_t);
 readline* editor_delete_forward_char        (container*, readline*, wint_t);
 readline* editor_delete_forward_word        (container*, readline*, wint_t);
@@ -138,12 +194,25 @@ readline* editor_page_center_cursor         (container*, readline*, wint_t);
 readline* editor_kill_to_end_of_line        (container*, readline*, readline*);
 readline* editor_kill_to_beginning_of_line  (container*, readline*, readline*);
 readline* editor_yank_line                  (container*, readline*, readline*);
+readline* editor_undo                       (container*, readline*, wint_t);
+readline* editor_redo                       (container*, readline*, wint_t);
 
 void      activate_minibuffer               (container*, readline*, int);
 void      deactivate_minibuffer             (container*, readline*);
 void      minibuffer_redraw                 (container*, readline*);
 void      editor_goto_line                  (container*, char[]);
-void      editor_search_forward             (container*, char[]);
+void      editor_isearch_begin              (container*, int, int);
+void      editor_isearch_update             (container*, readline*);
+void      editor_isearch_step               (container*, readline*, int);
+void      editor_isearch_cancel             (container*);
+void      editor_isearch_finish             (container*, char[]);
+void      editor_replace_compile            (container*, char[]);
+void      editor_replace_regexp             (container*, char[]);
+void      editor_replace_cancel             (container*);
+void      editor_count_matches              (container*, char[]);
+void      editor_toggle_index               (container*);
+void      infobar_print_index               (container*);
+void      infobar_print_memory              (container*);
 char*     strdup                            (const char*);
 
 #endif /* EDITOR_GUARD */
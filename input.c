@@ -0,0 +1,198 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include "row.h"
+#include "input.h"
+
+/* an escape sequence without a key */
+#define KEY_NONE 0x11FFFF
+
+/* what fill returns instead of a number of bytes */
+#define FILL_SIGNAL -1
+#define FILL_HANGUP -2
+#define FILL_ERROR  -3
+
+static unsigned char buffer[INPUT_BUFFER_SIZE];
+static int  start   = 0;
+static int  end     = 0;
+static char pasting = 0;
+static char hangup  = 0;
+
+/* Read what the terminal has, waiting up to timeout milliseconds or
+ * forever if it is negative. Returns the number of bytes read, 0 if
+ * none came, FILL_SIGNAL if a signal came first, FILL_HANGUP once the
+ * terminal is gone and FILL_ERROR with errno set if reading failed.
+ * Only end of file, EIO or a hangup reported by poll mean the terminal
+ * is gone, a descriptor left non-blocking is polled again. */
+static int fill(int timeout) {
+    if (hangup) return FILL_HANGUP;
+    if (start == end) start = end = 0;
+    if (end == INPUT_BUFFER_SIZE) {
+        memmove(buffer, &buffer[start], end - start);
+        end  -= start;
+        start = 0;
+    }
+    while (1) {
+        struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+        /* poll is never restarted after a signal, a window resize
+         * interrupts the wait */
+        int ready = poll(&fd, 1, timeout);
+        if (ready < 0) return errno == EINTR ? FILL_SIGNAL : FILL_ERROR;
+        if (ready == 0) return 0;
+        if (!(fd.revents & POLLIN)) {
+            hangup = (fd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+            return hangup ? FILL_HANGUP : 0;
+        }
+        int n = read(STDIN_FILENO, &buffer[end], INPUT_BUFFER_SIZE - end);
+        if (n > 0) {
+            end += n;
+            return n;
+        }
+        if (n == 0 || errno == EIO) {
+            hangup = 1;
+            return FILL_HANGUP;
+        }
+        if (errno == EINTR) return FILL_SIGNAL;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return FILL_ERROR;
+    }
+}
+
+/* makes sure n bytes are buffered, a sequence split by the terminal is
+ * completed within INPUT_ESCAPE_DELAY */
+static int have(int n) {
+    while (end - start < n)
+        if (fill(INPUT_ESCAPE_DELAY) <= 0) return 0;
+    return 1;
+}
+
+/* the key of ESC [ n ~ */
+static wint_t tilde_key(int n) {
+    switch (n) {
+        case 1: case 7: return KEY_HOME;
+        case 4: case 8: return KEY_END;
+        case 3:         return KEY_DELETE;
+        case 5:         return KEY_PAGE_UP;
+        case 6:         return KEY_PAGE_DOWN;
+        case 200:       pasting = 1; return KEY_PASTE_BEGIN;
+        case 201:       pasting = 0; return KEY_PASTE_END;
+    }
+    return KEY_NONE;
+}
+
+/* decode the sequence starting with the ESC at start */
+static wint_t escape(void) {
+    if (pasting) {
+        static const char close[] = "\033[201~";
+        for (int k = 1; k < 6; k++) {
+            if (!have(k + 1) || buffer[start + k] != close[k]) {
+                start++;
+                return 27;
+            }
+        }
+        start  += 6;
+        pasting = 0;
+        return KEY_PASTE_END;
+    }
+    /* ESC followed by a key is the alt modifier */
+    if (!have(2) || (buffer[start + 1] != '[' && buffer[start + 1] != 'O')) {
+        start++;
+        return 27;
+    }
+    /* CSI and SS3: parameters up to a final byte, only the first
+     * parameter is used */
+    int k = 2, param = 0, first = 1;
+    while (1) {
+        if (!have(k + 1)) {
+            start++;
+            return 27;
+        }
+        unsigned char c = buffer[start + k];
+        if (c >= 0x40 && c <= 0x7E) break;
+        if (c == ';')                      first = 0;
+        else if (first && c >= '0' && c <= '9') param = param * 10 + c - '0';
+        k++;
+    }
+    unsigned char final = buffer[start + k];
+    start += k + 1;
+    switch (final) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        case '~': return tilde_key(param);
+    }
+    return KEY_NONE;
+}
+
+/* number of bytes of the UTF-8 sequence starting with c */
+static int sequence_length(unsigned char c) {
+    if ((c & 0xE0) == 0xC0) return 2;
+    if ((c & 0xF0) == 0xE0) return 3;
+    if ((c & 0xF8) == 0xF0) return 4;
+    return 1;
+}
+
+/* The next key, waiting for it if none is buffered. WEOF if a signal
+ * interrupted the wait, KEY_ERROR with errno set if reading failed and
+ * KEY_HANGUP on every call once the terminal is gone. */
+wint_t input_read(void) {
+    while (1) {
+        while (start == end) {
+            int n = fill(-1);
+            if (n == FILL_SIGNAL) return WEOF;
+            if (n == FILL_HANGUP) return KEY_HANGUP;
+            if (n == FILL_ERROR)  return KEY_ERROR;
+        }
+        unsigned char c = buffer[start];
+        if (c == 27) {
+            wint_t key = escape();
+            if (key == KEY_NONE) continue;
+            return key;
+        }
+        if (c < 0x80) {
+            start++;
+            return c;
+        }
+        have(sequence_length(c));
+        wint_t key;
+        start += utf8_decode(&buffer[start], end - start, &key);
+        return key;
+    }
+}
+
+/* TRUE if a key can be read without waiting */
+int input_pending(void) {
+    if (start < end) return 1;
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&fd, 1, 0) > 0;
+}
+
+/* TRUE if a key can be read within timeout milliseconds, FALSE if none
+ * came, -1 if a signal interrupted the wait */
+int input_wait(int timeout) {
+    if (start < end) return 1;
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    int ready = poll(&fd, 1, timeout);
+    if (ready < 0) return errno == EINTR ? -1 : 1;
+    return ready > 0;
+}
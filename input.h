@@ -0,0 +1,54 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPUT_GUARD
+#define INPUT_GUARD
+
+#include <wchar.h>
+
+#define INPUT_BUFFER_SIZE  4096
+
+/* milliseconds to wait for the rest of a sequence that was split by
+ * the terminal or the connection */
+#define INPUT_ESCAPE_DELAY 25
+
+/* keys decoded from escape sequences, beyond the range of unicode */
+#define KEY_UP          0x110000
+#define KEY_DOWN        0x110001
+#define KEY_RIGHT       0x110002
+#define KEY_LEFT        0x110003
+#define KEY_HOME        0x110004
+#define KEY_END         0x110005
+#define KEY_DELETE      0x110006
+#define KEY_PAGE_UP     0x110007
+#define KEY_PAGE_DOWN   0x110008
+#define KEY_PASTE_BEGIN 0x110009
+#define KEY_PASTE_END   0x11000A
+#define KEY_HANGUP      0x11000B    /* the terminal is gone, for good */
+#define KEY_ERROR       0x11000C    /* reading failed, errno tells why */
+
+/* Keyboard input read with read(2) into a buffer, as many bytes as
+ * the terminal has ready. Keys are decoded from the buffer one at a
+ * time: UTF-8 characters, the escape sequences of the keys above, and
+ * ESC followed by a key for the alt modifier. Unknown sequences are
+ * dropped. Between KEY_PASTE_BEGIN and KEY_PASTE_END every byte is
+ * text, an ESC is returned as it is. */
+wint_t input_read    (void);
+int    input_pending (void);
+int    input_wait    (int);
+
+#endif /* INPUT_GUARD */
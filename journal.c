@@ -0,0 +1,342 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "undo.h"
+#include "journal.h"
+
+/* the header for filename as it is on disk now */
+static void stamp(const char *filename, char header[JOURNAL_HEADER_SIZE]) {
+    struct stat st;
+    int64_t stat_of[3] = { 0, 0, 0 };
+    if (stat(filename, &st) == 0) {
+        stat_of[0] = st.st_size;
+        stat_of[1] = st.st_mtim.tv_sec;
+        stat_of[2] = st.st_mtim.tv_nsec;
+    }
+    memcpy(header, JOURNAL_MAGIC, 4);
+    memcpy(header + 4, stat_of, sizeof(stat_of));
+}
+
+/* .NAME.mxj in the directory of filename */
+static char *journal_path(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    int dir = slash ? slash - filename + 1 : 0;
+    char *path = malloc(strlen(filename) + 6);
+    memcpy(path, filename, dir);
+    sprintf(path + dir, ".%s.mxj", filename + dir);
+    return path;
+}
+
+static int write_all(int fd, const char *data, long n) {
+    while (n > 0) {
+        ssize_t k = write(fd, data, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) return -1;
+        data += k;
+        n    -= k;
+    }
+    return 0;
+}
+
+/* Writes the buffer out, with the file lock held. The records count as
+ * written as soon as they leave the buffer. The first ones create the
+ * journal. */
+static void flush_locked(journal *j, int sync) {
+    pthread_mutex_lock(&j->lock);
+    char  *data = j->buffer;
+    size_t n    = j->used;
+    j->buffer   = NULL;
+    j->used     = j->capacity = 0;
+    j->written += n;
+    pthread_mutex_unlock(&j->lock);
+    if (n == 0) return;
+    if (j->fd == -1) {
+        j->fd = open(j->path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (j->fd != -1 && write_all(j->fd, j->header, JOURNAL_HEADER_SIZE) == -1) {
+            close(j->fd);
+            j->fd = -1;
+        }
+    }
+    if (j->fd != -1) {
+        write_all(j->fd, data, n);
+        if (sync) fsync(j->fd);
+    }
+    free(data);
+}
+
+static void *writer(void *arg) {
+    journal *j = arg;
+    pthread_mutex_lock(&j->lock);
+    while (!j->stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec  += JOURNAL_SYNC / 1000;
+        until.tv_nsec += (JOURNAL_SYNC % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&j->wake, &j->lock, &until);
+        pthread_mutex_unlock(&j->lock);
+        pthread_mutex_lock(&j->io);
+        flush_locked(j, 1);
+        pthread_mutex_unlock(&j->io);
+        pthread_mutex_lock(&j->lock);
+    }
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
+
+void journal_init(journal *j) {
+    memset(j, 0, sizeof(journal));
+    j->fd = -1;
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_mutex_init(&j->io, NULL);
+    pthread_cond_init(&j->wake, NULL);
+}
+
+/* Opens the journal of filename. Records left by a session that did
+ * not end cleanly are kept for journal_next if the file is unchanged
+ * since. Otherwise the file is left alone until the first records are
+ * written, which start it over. */
+void journal_open(journal *j, const char *filename) {
+    j->path = journal_path(filename);
+    j->fd   = open(j->path, O_RDWR);
+    stamp(filename, j->header);
+    struct stat st;
+    long length = j->fd != -1 && fstat(j->fd, &st) == 0 ? st.st_size : 0;
+    if (length > JOURNAL_HEADER_SIZE) {
+        j->replay = malloc(length);
+        if (pread(j->fd, j->replay, length, 0) != length
+            || memcmp(j->replay, j->header, JOURNAL_HEADER_SIZE) != 0) {
+            free(j->replay);
+            j->replay = NULL;
+        }
+    }
+    if (j->replay == NULL) {
+        if (j->fd != -1) close(j->fd);
+        j->fd  = -1;
+        length = JOURNAL_HEADER_SIZE;
+    }
+    j->replay_length = length;
+    j->replay_at     = JOURNAL_HEADER_SIZE;
+    j->replay_last   = JOURNAL_HEADER_SIZE;
+    j->written       = length;
+    j->open          = 1;
+}
+
+static int get_number(journal *j, long *n) {
+    *n = 0;
+    for (int shift = 0; shift < 35 && j->replay_at < j->replay_length; shift += 7) {
+        unsigned char c = j->replay[j->replay_at++];
+        *n |= (long) (c & 0x7F) << shift;
+        if (!(c & 0x80)) return *n <= 0x7FFFFFFF;
+    }
+    return 0;
+}
+
+/* Reads the next record found on open. Returns FALSE at the end and
+ * at a record that was not written completely, which is left unread. */
+int journal_next(journal *j, journal_entry *e) {
+    if (j->replay == NULL || j->replay_at >= j->replay_length) return 0;
+    j->replay_last = j->replay_at;
+    long kind = j->replay[j->replay_at++];
+    long row, cursor, length, bytes = 0;
+    if (kind < UNDO_INSERT || kind > UNDO_ERASE
+        || !get_number(j, &row) || !get_number(j, &cursor) || !get_number(j, &length)
+        || (kind == UNDO_INSERT && !get_number(j, &bytes))
+        || bytes > j->replay_length - j->replay_at
+        || (kind == UNDO_INSERT && length > bytes)) {
+        j->replay_at = j->replay_last;
+        return 0;
+    }
+    e->kind   = kind;
+    e->row    = row;
+    e->cursor = cursor;
+    e->length = length;
+    e->text   = NULL;
+    if (kind != UNDO_INSERT) return 1;
+    if (length > j->text_capacity) {
+        j->text_capacity = length;
+        j->text = realloc(j->text, sizeof(wint_t) * length);
+    }
+    const unsigned char *p = (const unsigned char *) &j->replay[j->replay_at];
+    int at = 0, k = 0;
+    while (at < bytes && k < length)
+        at += utf8_decode(&p[at], bytes - at, &j->text[k++]);
+    if (at != bytes || k != length) {
+        j->replay_at = j->replay_last;
+        return 0;
+    }
+    j->replay_at += bytes;
+    e->text = j->text;
+    return 1;
+}
+
+/* Done with the records found on open. If the last record read was not
+ * applied the journal ends before it, a torn record at the end is cut
+ * off either way. The writer starts. */
+void journal_replayed(journal *j, int rejected) {
+    if (!j->open) return;
+    if (j->replay != NULL) {
+        long end = rejected ? j->replay_last : j->replay_at;
+        if (end < j->replay_length && ftruncate(j->fd, end) == 0)
+            j->written = end;
+        free(j->replay);
+        j->replay = NULL;
+    }
+    free(j->text);
+    j->text = NULL;
+    j->text_capacity = 0;
+    if (j->fd != -1) lseek(j->fd, j->written, SEEK_SET);
+    j->mark    = j->written;
+    j->stop    = 0;
+    j->running = pthread_create(&j->thread, NULL, writer, j) == 0;
+}
+
+/*-----------------------------------------------  
+    recording
+ -----------------------------------------------*/
+
+static void reserve(journal *j, size_t n) {
+    if (j->used + n <= j->capacity) return;
+    j->capacity = 2 * (j->used + n);
+    j->buffer = realloc(j->buffer, j->capacity);
+}
+
+static void put_number(journal *j, unsigned long n) {
+    while (n >= 0x80) {
+        j->buffer[j->used++] = (n & 0x7F) | 0x80;
+        n >>= 7;
+    }
+    j->buffer[j->used++] = n;
+}
+
+/* Appends an edit recorded for undo. An insert carries its text, a
+ * delete only its length. */
+void journal_record(journal *j, int kind, int row, int cursor,
+                    const wint_t *text, int length) {
+    if (!j->open) return;
+    long bytes = 0;
+    if (kind == UNDO_INSERT)
+        for (int i = 0; i < length; i++)
+            bytes += text[i] < 0x80 ? 1 : text[i] < 0x800 ? 2 : text[i] < 0x10000 ? 3 : 4;
+    pthread_mutex_lock(&j->lock);
+    reserve(j, 1 + 4 * 5 + bytes);
+    j->buffer[j->used++] = kind;
+    put_number(j, row);
+    put_number(j, cursor);
+    put_number(j, length);
+    if (kind == UNDO_INSERT) {
+        put_number(j, bytes);
+        for (int i = 0; i < length; i++) {
+            if (text[i] < 0x80) j->buffer[j->used++] = text[i];
+            else                j->used += utf8_encode(text[i], &j->buffer[j->used]);
+        }
+    }
+    pthread_mutex_unlock(&j->lock);
+}
+
+/* A save starts: the records so far are in the saved file. */
+void journal_mark(journal *j) {
+    pthread_mutex_lock(&j->lock);
+    j->mark = j->written + j->used;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/* The save begun at the last mark is on disk as filename: the journal
+ * is rewritten to the records made since, behind a header for the
+ * saved file, and renamed over the old one. */
+void journal_compact(journal *j, const char *filename) {
+    if (!j->open) return;
+    pthread_mutex_lock(&j->io);
+    flush_locked(j, 0);
+    pthread_mutex_lock(&j->lock);
+    long tail = j->written - j->mark;
+    /* with no records left the journal goes until the next ones */
+    if (j->fd == -1 || tail == 0) {
+        if (j->fd != -1) {
+            close(j->fd);
+            unlink(j->path);
+        }
+        j->fd      = -1;
+        j->written = j->mark = JOURNAL_HEADER_SIZE;
+        stamp(filename, j->header);
+        pthread_mutex_unlock(&j->lock);
+        pthread_mutex_unlock(&j->io);
+        return;
+    }
+    char *data = malloc(JOURNAL_HEADER_SIZE + tail);
+    stamp(filename, data);
+    char *temp = malloc(strlen(j->path) + 8);
+    sprintf(temp, "%s.XXXXXX", j->path);
+    int fd = mkstemp(temp);
+    if (fd != -1
+        && pread(j->fd, data + JOURNAL_HEADER_SIZE, tail, j->mark) == tail
+        && write_all(fd, data, JOURNAL_HEADER_SIZE + tail) == 0
+        && fsync(fd) == 0
+        && rename(temp, j->path) == 0) {
+        close(j->fd);
+        memcpy(j->header, data, JOURNAL_HEADER_SIZE);
+        j->fd      = fd;
+        j->written = JOURNAL_HEADER_SIZE + tail;
+        j->mark    = JOURNAL_HEADER_SIZE;
+    } else if (fd != -1) {
+        close(fd);
+        unlink(temp);
+    }
+    free(temp);
+    free(data);
+    pthread_mutex_unlock(&j->lock);
+    pthread_mutex_unlock(&j->io);
+}
+
+/* Stops the writer and closes the journal, which is removed on a clean
+ * quit and otherwise left for the next session. */
+void journal_close(journal *j, int remove) {
+    if (!j->open) return;
+    if (j->running) {
+        pthread_mutex_lock(&j->lock);
+        j->stop = 1;
+        pthread_cond_signal(&j->wake);
+        pthread_mutex_unlock(&j->lock);
+        pthread_join(j->thread, NULL);
+        j->running = 0;
+    }
+    pthread_mutex_lock(&j->io);
+    flush_locked(j, 1);
+    pthread_mutex_unlock(&j->io);
+    if (j->fd != -1) close(j->fd);
+    j->fd = -1;
+    if (remove) unlink(j->path);
+    free(j->path);
+    free(j->replay);
+    free(j->text);
+    j->path   = NULL;
+    j->replay = NULL;
+    j->text   = NULL;
+    j->open   = 0;
+}
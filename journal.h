@@ -0,0 +1,86 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JOURNAL_GUARD
+#define JOURNAL_GUARD
+
+#include <pthread.h>
+#include <wchar.h>
+
+/* milliseconds between two writes of the journal to disk */
+#define JOURNAL_SYNC 1000
+
+#define JOURNAL_MAGIC "mxj1"
+
+/* magic, size and modification time of the file */
+#define JOURNAL_HEADER_SIZE 28
+
+/* Crash recovery journal of a file, kept as .NAME.mxj next to it.
+ * Every edit of the document is appended as a record: its kind, row,
+ * cursor and length as variable length numbers, followed by the text
+ * of an insert in UTF-8. Recording only copies the record into a
+ * buffer, a thread writes the buffer and fsyncs the journal every
+ * JOURNAL_SYNC milliseconds.
+ *
+ * The journal starts with the size and modification time of the file
+ * it belongs to, it is replayed only onto that very file. It is created
+ * when the first records are written, so viewing a file leaves none
+ * behind. A save compacts it to the records made after the save
+ * started, a clean quit removes it. */
+typedef struct journal {
+    char            open;
+    char            running;        /* writer thread started */
+    char            stop;
+    int             fd;             /* -1 until records are written */
+    char           *path;
+    char            header[JOURNAL_HEADER_SIZE];
+    pthread_t       thread;
+    pthread_mutex_t lock;           /* the buffer */
+    pthread_mutex_t io;             /* the file, taken before lock */
+    pthread_cond_t  wake;
+    char           *buffer;         /* records not written yet */
+    size_t          used;
+    size_t          capacity;
+    long            written;        /* bytes in the file */
+    long            mark;           /* end of the records in the last save */
+    char           *replay;         /* records found on open, NULL if none */
+    long            replay_length;
+    long            replay_at;
+    long            replay_last;    /* start of the record read last */
+    wint_t         *text;           /* of the record read last */
+    int             text_capacity;
+} journal;
+
+/* one record read back by journal_next */
+typedef struct journal_entry {
+    int     kind;                   /* enum undo_kind */
+    int     row;
+    int     cursor;
+    int     length;                 /* characters */
+    wint_t *text;                   /* of an insert, valid until the next */
+} journal_entry;
+
+void journal_init     (journal*);
+void journal_open     (journal*, const char*);
+int  journal_next     (journal*, journal_entry*);
+void journal_replayed (journal*, int);
+void journal_record   (journal*, int, int, int, const wint_t*, int);
+void journal_mark     (journal*);
+void journal_compact  (journal*, const char*);
+void journal_close    (journal*, int);
+
+#endif /* JOURNAL_GUARD */
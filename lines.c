@@ -0,0 +1,339 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lines.h"
+
+#define NODE_MIN (LINE_NODE_SIZE / 2)
+
+
+static line_node *node_new(char leaf) {
+    line_node *node = calloc(1, sizeof(line_node));
+    node->leaf = leaf;
+    return node;
+}
+
+/* the rows of a leaf changed, its summary no longer holds */
+static void node_stale(line_node *node) {
+    free(node->summary);
+    node->summary = NULL;
+}
+
+line_node *lines_new(void) {
+    return node_new(1);
+}
+
+/* Frees the tree and every row stored in it. */
+void lines_free(line_node *node) {
+    for (int i = 0; i < node->count && node->source == NULL; i++) {
+        if (node->leaf) {
+            free_row(node->entry.row[i]);
+            slab_free(node->entry.row[i], sizeof(readline));
+        } else {
+            lines_free(node->entry.child[i]);
+        }
+    }
+    free(node->summary);
+    free(node);
+}
+
+/* Returns the child of an inner node holding line *index and makes
+ * *index relative to that child. */
+static int node_find_child(line_node *node, int *index) {
+    int i;
+    for (i = 0; i < node->count - 1; i++) {
+        if (*index < node->entry.child[i]->lines) break;
+        *index -= node->entry.child[i]->lines;
+    }
+    return i;
+}
+
+readline *lines_get(line_node *node, int index) {
+    if (index < 0 || index >= node->lines) return NULL;
+    while (!node->leaf)
+        node = node->entry.child[node_find_child(node, &index)];
+    lines_page_in_leaf(node);
+    return node->entry.row[index];
+}
+
+/* Moves the upper half of a full node into a new right sibling. */
+static line_node *node_split(line_node *node) {
+    line_node *right = node_new(node->leaf);
+    int half = node->count / 2;
+    right->count = node->count - half;
+    memcpy(&right->entry.child[0], &node->entry.child[half],
+           right->count * sizeof(void *));
+    node->count = half;
+    if (node->leaf) {
+        node_stale(node);
+        right->lines = right->count;
+        right->next  = node->next;
+        node->next   = right;
+    } else {
+        for (int i = 0; i < right->count; i++)
+            right->lines += right->entry.child[i]->lines;
+    }
+    node->lines -= right->lines;
+    return right;
+}
+
+/* inserts entry into the entry array of node at position pos */
+static void node_put(line_node *node, int pos, void *entry) {
+    memmove(&node->entry.child[pos + 1], &node->entry.child[pos],
+            (node->count - pos) * sizeof(void *));
+    node->entry.child[pos] = entry;
+    node->count++;
+    if (node->leaf) node_stale(node);
+}
+
+static void node_take(line_node *node, int pos) {
+    memmove(&node->entry.child[pos], &node->entry.child[pos + 1],
+            (node->count - pos - 1) * sizeof(void *));
+    node->count--;
+    if (node->leaf) node_stale(node);
+}
+
+/* Returns a new right sibling if node had to be split, NULL otherwise. */
+static line_node *node_insert(line_node *node, int index, readline *row) {
+    line_node *right = NULL;
+    if (node->leaf) lines_page_in_leaf(node);
+    if (node->count == LINE_NODE_SIZE) {
+        right = node_split(node);
+        if (index > node->lines) {
+            index -= node->lines;
+            node_insert(right, index, row);
+            return right;
+        }
+    }
+    if (node->leaf) {
+        node_put(node, index, row);
+    } else {
+        int i;
+        /* appending is the common case while loading a file */
+        if (index == node->lines) {
+            i = node->count - 1;
+            index = node->entry.child[i]->lines;
+        } else {
+            i = node_find_child(node, &index);
+        }
+        line_node *child = node->entry.child[i];
+        line_node *sibling = node_insert(child, index, row);
+        if (sibling) node_put(node, i + 1, sibling);
+    }
+    node->lines++;
+    return right;
+}
+
+/* Inserts row so that it becomes line index, returns the new root. */
+line_node *lines_insert(line_node *root, int index, readline *row) {
+    if (index < 0) index = 0;
+    if (index > root->lines) index = root->lines;
+    line_node *right = node_insert(root, index, row);
+    if (right) {
+        line_node *new_root = node_new(0);
+        new_root->entry.child[0] = root;
+        new_root->entry.child[1] = right;
+        new_root->count = 2;
+        new_root->lines = root->lines + right->lines;
+        return new_root;
+    }
+    return root;
+}
+
+/* Merges child i + 1 into child i of node. */
+static void node_merge(line_node *node, int i) {
+    line_node *left  = node->entry.child[i];
+    line_node *right = node->entry.child[i + 1];
+    if (left->leaf) {
+        lines_page_in_leaf(left);
+        lines_page_in_leaf(right);
+    }
+    memcpy(&left->entry.child[left->count], &right->entry.child[0],
+           right->count * sizeof(void *));
+    left->count += right->count;
+    left->lines += right->lines;
+    if (left->leaf) {
+        left->next = right->next;
+        node_stale(left);
+    }
+    free(right->summary);
+    free(right);
+    node_take(node, i + 1);
+}
+
+static readline *node_remove(line_node *node, int index) {
+    readline *row;
+    if (node->leaf) {
+        lines_page_in_leaf(node);
+        row = node->entry.row[index];
+        node_take(node, index);
+    } else {
+        int i = node_find_child(node, &index);
+        line_node *child = node->entry.child[i];
+        row = node_remove(child, index);
+        /* keep nodes at least half full where a neighbour can take them */
+        if (child->count < NODE_MIN && node->count > 1) {
+            if (i + 1 < node->count
+                && child->count + node->entry.child[i + 1]->count <= LINE_NODE_SIZE)
+                node_merge(node, i);
+            else if (i > 0
+                && child->count + node->entry.child[i - 1]->count <= LINE_NODE_SIZE)
+                node_merge(node, i - 1);
+        }
+    }
+    node->lines--;
+    return row;
+}
+
+/* Removes line index and stores its row in *row. Returns the new root. */
+line_node *lines_remove(line_node *root, int index, readline **row) {
+    *row = NULL;
+    if (index < 0 || index >= root->lines) return root;
+    *row = node_remove(root, index);
+    while (!root->leaf && root->count == 1) {
+        line_node *child = root->entry.child[0];
+        free(root);
+        root = child;
+    }
+    return root;
+}
+
+/* Positions iter at line index and returns that row. */
+readline *lines_iter_start(line_node *node, int index, line_iter *iter) {
+    iter->leaf = NULL;
+    if (index < 0 || index >= node->lines) return NULL;
+    while (!node->leaf)
+        node = node->entry.child[node_find_child(node, &index)];
+    lines_page_in_leaf(node);
+    iter->leaf = node;
+    iter->pos  = index;
+    return node->entry.row[index];
+}
+
+/* Advances iter by one line, returns NULL past the last line. */
+readline *lines_iter_next(line_iter *iter) {
+    if (iter->leaf == NULL) return NULL;
+    iter->pos++;
+    while (iter->leaf && iter->pos >= iter->leaf->count) {
+        iter->leaf = iter->leaf->next;
+        iter->pos  = 0;
+    }
+    if (iter->leaf == NULL) return NULL;
+    if (iter->pos == 0) lines_page_in_leaf(iter->leaf);
+    return iter->leaf->entry.row[iter->pos];
+}
+
+/* The text of line index changed: drops the summary of its leaf. */
+void lines_touch(line_node *node, int index) {
+    if (index < 0 || index >= node->lines) return;
+    while (!node->leaf)
+        node = node->entry.child[node_find_child(node, &index)];
+    node_stale(node);
+}
+
+/*-----------------------------------------------  
+    mapped files
+ -----------------------------------------------*/
+
+/* Returns a leaf over the next LINE_NODE_SIZE lines of the mapped
+ * text from p to end without decoding any of them, it only remembers
+ * where they are. *done is set when the leaf holds the last line, the
+ * one behind the last newline. */
+line_node *lines_map_leaf(const char *p, const char *end, int *done) {
+    line_node *leaf = node_new(1);
+    leaf->source = p;
+    *done = 0;
+    while (leaf->count < LINE_NODE_SIZE && !*done) {
+        const char *newline = memchr(p, 0xA, end - p);
+        leaf->count++;
+        *done = newline == NULL;
+        p     = *done ? end : newline + 1;
+    }
+    leaf->lines         = leaf->count;
+    leaf->source_length = p - leaf->source;
+    return leaf;
+}
+
+/* Hangs leaf below the last inner node on the right edge of the tree.
+ * Returns a new right sibling of node if node was full. */
+static line_node *node_append(line_node *node, line_node *leaf) {
+    if (node->leaf) return leaf;
+    line_node *sibling = node_append(node->entry.child[node->count - 1], leaf);
+    node->lines += leaf->lines;
+    if (sibling == NULL) return NULL;
+    if (node->count < LINE_NODE_SIZE) {
+        node->entry.child[node->count++] = sibling;
+        return NULL;
+    }
+    /* appended nodes are filled one after another, the full one stays
+     * full instead of being split in halves */
+    line_node *right = node_new(0);
+    right->entry.child[0] = sibling;
+    right->count = 1;
+    right->lines = sibling->lines;
+    node->lines -= sibling->lines;
+    return right;
+}
+
+/* Appends leaf, from lines_map_leaf, behind the last line of the tree
+ * and returns the new root. The text of leaf has to stay mapped as
+ * long as the tree lives. */
+line_node *lines_append_leaf(line_node *root, line_node *leaf) {
+    if (root->leaf && root->count == 0) {
+        lines_free(root);
+        return leaf;
+    }
+    line_node *last = root;
+    while (!last->leaf) last = last->entry.child[last->count - 1];
+    last->next = leaf;
+    line_node *right = node_append(root, leaf);
+    if (right) {
+        line_node *new_root = node_new(0);
+        new_root->entry.child[0] = root;
+        new_root->entry.child[1] = right;
+        new_root->count = 2;
+        new_root->lines = root->lines + right->lines;
+        return new_root;
+    }
+    return root;
+}
+
+/* Gives the leaf rows reading their lines from the mapped file. */
+void lines_page_in_leaf(line_node *leaf) {
+    if (leaf->source == NULL) return;
+    const char *p   = leaf->source;
+    const char *end = leaf->source + leaf->source_length;
+    for (int i = 0; i < leaf->count; i++) {
+        const char *newline = memchr(p, 0xA, end - p);
+        const char *line_end = newline ? newline : end;
+        readline *row = slab_alloc(sizeof(readline));
+        make_new_row(row);
+        row_map_utf8(row, p, line_end - p);
+        leaf->entry.row[i] = row;
+        p = newline ? newline + 1 : end;
+    }
+    leaf->source = NULL;
+}
+
+/* Pages in the leaves holding the lines [from, to). */
+void lines_page_in(line_node *node, int from, int to) {
+    line_iter iter;
+    if (lines_iter_start(node, from, &iter) == NULL) return;
+    for (int row = from - iter.pos; iter.leaf && row < to; iter.leaf = iter.leaf->next) {
+        lines_page_in_leaf(iter.leaf);
+        row += iter.leaf->count;
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LINES_GUARD
+#define LINES_GUARD
+
+#include "row.h"
+
+/* Number of entries per tree node. Rows are moved around only within
+ * one node, so inserting or deleting a line touches at most
+ * LINE_NODE_SIZE pointers per tree level. */
+#define LINE_NODE_SIZE 64
+
+/* B+ tree of rows. Every node knows how many lines are stored below it,
+ * so a row can be found by its index in O(log n). Leaves are chained
+ * for sequential walks over the document.
+ *
+ * The leaves made by lines_map_leaf start out holding no rows,
+ * only where their lines begin in the mapped file. A leaf is paged in,
+ * its rows made to read their text in place, the first time one of its
+ * rows is asked for or the leaf itself is changed. */
+typedef struct line_node {
+    char  leaf;
+    int   count;                 /* used entries */
+    int   lines;                 /* lines stored below this node */
+    struct line_node *next;      /* next leaf */
+    void *summary;               /* leaf: search index of its rows, one
+                                  * block freed when the leaf changes */
+    const char *source;          /* leaf not paged in yet: its lines */
+    long  source_length;
+    union {
+        struct line_node *child[LINE_NODE_SIZE];
+        readline         *row  [LINE_NODE_SIZE];
+    } entry;
+} line_node;
+
+typedef struct line_iter {
+    line_node *leaf;
+    int        pos;
+} line_iter;
+
+line_node* lines_new        (void);
+void       lines_free       (line_node*);
+readline*  lines_get        (line_node*, int);
+line_node* lines_insert     (line_node*, int, readline*);
+line_node* lines_remove     (line_node*, int, readline**);
+readline*  lines_iter_start (line_node*, int, line_iter*);
+readline*  lines_iter_next  (line_iter*);
+void       lines_touch      (line_node*, int);
+line_node* lines_map_leaf   (const char*, const char*, int*);
+line_node* lines_append_leaf(line_node*, line_node*);
+void       lines_page_in    (line_node*, int, int);
+void       lines_page_in_leaf(line_node*);
+
+#endif /* LINES_GUARD */
@@ -0,0 +1,261 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE /* madvise */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "slab.h"
+#include "load.h"
+
+static double seconds_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void load_init(file_load *l, line_node **rows, int *max_row,
+               pthread_mutex_t *lock) {
+    memset(l, 0, sizeof(file_load));
+    l->rows    = rows;
+    l->max_row = max_row;
+    l->lock    = lock;
+}
+
+/* the whole file is in the tree, called with the lock held */
+static void load_done(file_load *l) {
+    l->done    = 1;
+    l->seconds = seconds_since(&l->start);
+}
+
+/*-----------------------------------------------  
+    reading
+ -----------------------------------------------*/
+
+/* Reads up to size more bytes behind the unfinished line. A line that
+ * fills the whole block makes it grow. Returns 0 at the end of the
+ * file and after an error. */
+static ssize_t read_block(file_load *l, size_t size) {
+    if (l->used == l->block_size) {
+        l->block_size *= 2;
+        l->block = realloc(l->block, l->block_size);
+    }
+    if (size > l->block_size - l->used) size = l->block_size - l->used;
+    ssize_t n;
+    while ((n = read(l->fd, &l->block[l->used], size)) < 0 && errno == EINTR);
+    if (n < 0) {
+        l->error = errno;
+        return 0;
+    }
+    return n;
+}
+
+static void append_row(file_load *l, const char *text, size_t length) {
+    readline *row = slab_alloc(sizeof(readline));
+    make_new_row(row);
+    row_load_utf8(row, text, length);
+    *l->rows    = lines_insert(*l->rows, (*l->rows)->lines, row);
+    *l->max_row = (*l->rows)->lines;
+}
+
+/* Cuts the n bytes just read and the unfinished line before them into
+ * rows at the newlines found by memchr. Every row is sized exactly
+ * once by row_load_utf8, the rest of a line is moved to the front of
+ * the block and completed by the next read. At the end of the file it
+ * becomes the last row. The loader thread gives the lock up every
+ * LOAD_BATCH lines, the caller holds it. */
+static void cut_rows(file_load *l, ssize_t n, int yield) {
+    char *line      = l->block;
+    char *block_end = &l->block[l->used + n];
+    char *newline;
+    int   batch     = 0;
+    while ((newline = memchr(line, 0xA, block_end - line)) != NULL) {
+        append_row(l, line, newline - line);
+        l->loaded += newline + 1 - line;
+        line = newline + 1;
+        if (yield && ++batch == LOAD_BATCH) {
+            pthread_mutex_unlock(l->lock);
+            pthread_mutex_lock(l->lock);
+            batch = 0;
+        }
+    }
+    l->used = block_end - line;
+    memmove(l->block, line, l->used);
+    if (n == 0) {
+        append_row(l, l->block, l->used);
+        l->loaded += l->used;
+        load_done(l);
+    }
+}
+
+static void *reader(void *arg) {
+    file_load *l = arg;
+    while (1) {
+        ssize_t n = read_block(l, LOAD_BLOCK_SIZE);
+        pthread_mutex_lock(l->lock);
+        cut_rows(l, n, 1);
+        int done = l->done;
+        pthread_mutex_unlock(l->lock);
+        if (done) break;
+    }
+    free(l->block);
+    l->block = NULL;
+    close(l->fd);
+    return NULL;
+}
+
+/* Reads the file fd of length bytes into the empty document, the first
+ * screen lines right away and the rest in the background. The caller
+ * holds the lock. */
+void load_read(file_load *l, int fd, size_t length, int screen) {
+    clock_gettime(CLOCK_MONOTONIC, &l->start);
+    l->loading    = 1;
+    l->mapped     = 0;
+    l->fd         = fd;
+    l->length     = length;
+    l->block_size = LOAD_BLOCK_SIZE;
+    l->block      = malloc(l->block_size);
+    /* a small file is read to its end, the loader is not needed */
+    while (!l->done && (*l->max_row < screen || l->loaded + l->used >= length))
+        cut_rows(l, read_block(l, LOAD_FIRST_BLOCK), 0);
+    if (!l->done)
+        l->running = pthread_create(&l->thread, NULL, reader, l) == 0;
+    if (l->running) return;
+    /* without a thread the file is read right here */
+    while (!l->done)
+        cut_rows(l, read_block(l, LOAD_BLOCK_SIZE), 0);
+    free(l->block);
+    l->block = NULL;
+    close(fd);
+}
+
+/*-----------------------------------------------  
+    mapping
+ -----------------------------------------------*/
+
+/* appends the leaves for up to count more lines, the caller holds the
+ * lock */
+static void append_leaves(file_load *l, line_node **leaves, int count) {
+    for (int i = 0; i < count; i++)
+        *l->rows = lines_append_leaf(*l->rows, leaves[i]);
+    *l->max_row = (*l->rows)->lines;
+    if (count > 0)
+        l->loaded = leaves[count - 1]->source + leaves[count - 1]->source_length
+                    - l->text;
+}
+
+/* Scans up to count leaves from where the tree ends. Returns the number
+ * of leaves, *done is set when the last one ends the file. */
+static int scan_leaves(file_load *l, line_node **leaves, int count, int *done) {
+    const char *p   = l->text + l->loaded;
+    const char *end = l->text + l->length;
+    int n = 0;
+    *done = 0;
+    while (n < count && !*done) {
+        leaves[n] = lines_map_leaf(p, end, done);
+        p = leaves[n]->source + leaves[n]->source_length;
+        n++;
+    }
+    /* the scanned pages are read again when a leaf is paged in */
+    long page = sysconf(_SC_PAGESIZE);
+    if (p - l->released >= LOAD_RELEASE || *done) {
+        const char *upto = l->text + (p - l->text) / page * page;
+        madvise((void *) l->released, upto - l->released, MADV_DONTNEED);
+        l->released = upto;
+    }
+    return n;
+}
+
+static void *mapper(void *arg) {
+    file_load *l = arg;
+    line_node *leaves[LOAD_BATCH / LINE_NODE_SIZE];
+    int done = 0;
+    while (!done) {
+        /* only the leaves of the last batch are scanned by now, the
+         * rest of the file is not touched by the editor */
+        int n = scan_leaves(l, leaves, LOAD_BATCH / LINE_NODE_SIZE, &done);
+        pthread_mutex_lock(l->lock);
+        append_leaves(l, leaves, n);
+        if (done) load_done(l);
+        pthread_mutex_unlock(l->lock);
+    }
+    return NULL;
+}
+
+/* Maps the file fd of length bytes instead of reading it. The document
+ * is replaced by a tree over the lines of the first screen, the rest
+ * are counted in the background. The mapping is never released, a
+ * save renames a new file over the old one, which stays intact.
+ * Returns FALSE if the file could not be mapped. The caller holds the
+ * lock. */
+int load_map(file_load *l, int fd, size_t length, int screen) {
+    clock_gettime(CLOCK_MONOTONIC, &l->start);
+    char *text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) return 0;
+    close(fd);
+    l->loading  = 1;
+    l->mapped   = 1;
+    l->text     = text;
+    l->released = text;
+    l->length   = length;
+    lines_free(*l->rows);
+    *l->rows = lines_new();
+    line_node *leaf;
+    int done = 0;
+    while (!done && *l->max_row < screen) {
+        scan_leaves(l, &leaf, 1, &done);
+        append_leaves(l, &leaf, 1);
+    }
+    if (done) load_done(l);
+    else      l->running = pthread_create(&l->thread, NULL, mapper, l) == 0;
+    if (l->running) return 1;
+    while (!done) {
+        scan_leaves(l, &leaf, 1, &done);
+        append_leaves(l, &leaf, 1);
+    }
+    load_done(l);
+    return 1;
+}
+
+/*-----------------------------------------------  
+    editor side
+ -----------------------------------------------*/
+
+/* TRUE once when the load is complete, the loader thread is joined.
+ * The caller holds the lock. */
+int load_finish(file_load *l) {
+    if (!l->loading || !l->done) return 0;
+    if (l->running) {
+        pthread_join(l->thread, NULL);
+        l->running = 0;
+    }
+    l->loading = 0;
+    return 1;
+}
+
+/* Waits until the whole file is in the tree. The caller holds the lock,
+ * which is released while waiting for the loader. */
+void load_wait(file_load *l) {
+    if (!l->running) return;
+    pthread_mutex_unlock(l->lock);
+    pthread_join(l->thread, NULL);
+    pthread_mutex_lock(l->lock);
+    l->running = 0;
+}
+
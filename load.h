@@ -0,0 +1,81 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOAD_GUARD
+#define LOAD_GUARD
+
+#include <pthread.h>
+#include <time.h>
+#include "lines.h"
+
+/* size of the reads of the background loader */
+#define LOAD_BLOCK_SIZE  (4 << 20)
+
+/* size of the reads for the first screen, kept small so that it shows
+ * up at once however large the file is */
+#define LOAD_FIRST_BLOCK (64 << 10)
+
+/* lines the loader appends each time it holds the lock */
+#define LOAD_BATCH 4096
+
+/* files at least this large are mapped instead of read, MX_MAP_SIZE
+ * sets the size in MB */
+#define LOAD_MAP_SIZE (512L << 20)
+
+/* mapped pages the loader scanned are handed back to the kernel this
+ * many bytes at a time */
+#define LOAD_RELEASE (64 << 20)
+
+/* Loads a file into the line tree while the editor runs. The lines of
+ * the first screen are loaded by the caller, the rest by a thread that
+ * appends them behind the last row of the document in batches.
+ *
+ * A file is either read and decoded into rows, or mapped, in which
+ * case only its newlines are counted and leaves are appended that page
+ * in their rows when they are first used. Like the trigram builder the
+ * loader only changes the tree while it holds the lock of the
+ * document, which the editor gives up while it waits for a key. */
+typedef struct file_load {
+    char             loading;        /* started and not finished yet */
+    char             running;        /* loader thread started */
+    char             done;           /* the whole file is in the tree */
+    char             mapped;
+    int              error;          /* errno of a failed read */
+    pthread_t        thread;
+    pthread_mutex_t *lock;           /* lock of the document */
+    line_node      **rows;           /* the document, the root may change */
+    int             *max_row;
+    int              fd;
+    size_t           length;         /* size of the file */
+    size_t           loaded;         /* bytes in the tree */
+    size_t           shown;          /* bytes loaded at the last report */
+    char            *block;          /* read: the line not complete yet */
+    size_t           block_size;
+    size_t           used;
+    const char      *text;           /* mapped: the file */
+    const char      *released;       /* pages before were handed back */
+    struct timespec  start;
+    double           seconds;        /* time the load took */
+} file_load;
+
+void load_init   (file_load*, line_node**, int*, pthread_mutex_t*);
+void load_read   (file_load*, int, size_t, int);
+int  load_map    (file_load*, int, size_t, int);
+int  load_finish (file_load*);
+void load_wait   (file_load*);
+
+#endif /* LOAD_GUARD */
@@ -23,22 +23,40 @@
 char WIN_RESIZED = FALSE;
 void win_resize_handler(int sig) {
     WIN_RESIZED = TRUE;
+    term_resized();
     signal(SIGWINCH, win_resize_handler);
 }
 
-readline *handle_arrow_keys(container *con, readline *row_pointer)
+/* The terminal wraps pasted text in ESC [ 200 ~ and ESC [ 201 ~. The
+ * text in between is collected and inserted in one go, instead of
+ * going through the key bindings character by character. */
+readline *handle_paste(container *con, readline *row_pointer)
 {
-    wint_t unichar = getwchar();
-    switch (unichar) {
-        case 'A':
-            return editor_move_previous_line(con, row_pointer, unichar);
-        case 'B':
-            return editor_move_next_line(con, row_pointer, unichar);
-        case 'C':
-            return editor_forward_char(con, row_pointer, unichar);
-        case 'D':
-            return editor_backward_char(con, row_pointer, unichar);
+    int     capacity = PASTE_BLOCK_SIZE;
+    int     length   = 0;
+    wint_t *text     = malloc(sizeof(wint_t) * capacity);
+    wint_t  unichar;
+    while ((unichar = input_read()) != KEY_PASTE_END) {
+        if (unichar == WEOF || unichar == KEY_HANGUP || unichar == KEY_ERROR) {
+            /* a window resize interrupts the read */
+            if (WIN_RESIZED && unichar == WEOF) continue;
+            break;
+        }
+        if (length == capacity) {
+            capacity *= 2;
+            text = realloc(text, sizeof(wint_t) * capacity);
+        }
+        /* some terminals send a carriage return for a line break */
+        text[length++] = unichar == 0xD ? 0xA : unichar;
+    }
+    if (con->minibuffer_mode) {
+        /* the prompt is a single line without control characters */
+        for (int i = 0; i < length; i++)
+            if (text[i] >= 0x20) editor_insert_char(con, row_pointer, text[i]);
+    } else {
+        row_pointer = editor_insert_string(con, row_pointer, text, length);
     }
+    free(text);
     return row_pointer;
 }
 
@@ -73,24 +91,60 @@ readline *handle_save (container *con, readline *row_pointer,
     }
 }
 
-readline *handle_search_forward (container *con, readline *row_pointer,
-                      readline *minibuffer_pointer)
+readline *handle_isearch (container *con, readline *row_pointer,
+                          readline *minibuffer_pointer, int forward, int regexp)
 {
+    if (con->search.active) {
+        editor_isearch_step(con, row_pointer, forward);
+        return row_pointer;
+    }
     if (con->minibuffer_mode) return row_pointer;
-    infobar_print(con, "SEARCH FORWARD:");
+    infobar_print(con, regexp ? "Regexp I-search:" : "I-search:");
+    make_new_row(minibuffer_pointer);
+    activate_minibuffer(con, minibuffer_pointer, regexp ? 17 : 10);
+    editor_isearch_begin(con, forward, regexp);
+    return minibuffer_pointer;
+}
+
+readline *handle_replace (container *con, readline *row_pointer,
+                          readline *minibuffer_pointer)
+{
+    if (con->minibuffer_mode) return row_pointer;
+    infobar_print(con, "Replace regexp:");
     make_new_row(minibuffer_pointer);
     activate_minibuffer(con, minibuffer_pointer, 16);
     return minibuffer_pointer;
 }
 
+readline *handle_count (container *con, readline *row_pointer,
+                        readline *minibuffer_pointer)
+{
+    if (con->minibuffer_mode) return row_pointer;
+    infobar_print(con, "Count regexp:");
+    make_new_row(minibuffer_pointer);
+    activate_minibuffer(con, minibuffer_pointer, 14);
+    return minibuffer_pointer;
+}
+
+/* second prompt of M-%, once the regexp is compiled */
+readline *handle_replace_with (container *con, readline *minibuffer_pointer)
+{
+    infobar_print(con, "Replace with:");
+    make_new_row(minibuffer_pointer);
+    activate_minibuffer(con, minibuffer_pointer, 14);
+    return minibuffer_pointer;
+}
+
 readline *handle_cancel (container *con, readline *row_pointer,
                          readline *minibuffer_pointer)
 {
     if (con->minibuffer_mode) {
+        if (con->search.active) editor_isearch_cancel(con);
+        editor_replace_cancel(con);
         deactivate_minibuffer(con, row_pointer);
-        free(minibuffer_pointer->buffer);
+        free_row(minibuffer_pointer);
         infobar_print(con, "Quit\0");
-        return &(con->rows[con->current_row]);
+        return container_row(con, con->current_row);
     }
     return row_pointer;
 }
@@ -102,24 +156,16 @@ int main (int argc, char *argv[]) {
 
     setlocale (LC_ALL, "");
 
-    /* save terminal terminal parameters */
-    static struct termios oldt, newt;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-
-    /*  set terminal to raw mode
-     *  ICANON    input is not buffered
-     *  ECHO      don't write input to screen
-     *  ISIG      ignore control signals
-     *  VMIN      number of characters to read
-     *  VTIME     wait indefinitely
-     */
-    newt.c_iflag&= ~(ISTRIP | INLCR | IXON | IXANY | IXOFF);
-    newt.c_lflag &= ~(ISIG | ICANON | ECHO | ECHOE | ECHOK | ECHONL);
-    newt.c_cc[VMIN] = 1;
-    newt.c_cc[VTIME] = 0;
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    /* the window size is cached, install the handler before it is read */
+    signal(SIGWINCH, win_resize_handler);
+    /* a hangup is noticed by the input, which ends the editor keeping
+     * the journal */
+    signal(SIGHUP, SIG_IGN);
+
+    /* save terminal parameters and set the terminal to raw mode */
+    term_raw_mode();
     ANSI_RESET_SCREEN;
+    ANSI_PASTE_ON;
 
     wint_t unichar;        /* holds multibyte characters */
     container con;         /* container that keeps tracks of readlines */
@@ -127,9 +173,11 @@ int main (int argc, char *argv[]) {
 
     char ctrl_x_modifier = FALSE;
     char alt_modifier    = FALSE;
+    int  batched         = 0;     /* keys applied since the last frame */
 
     char message[MINIBUFFER_LIMIT];
     memset(message, 0, MINIBUFFER_LIMIT);
+    wchar_t wmessage[MINIBUFFER_LIMIT + 1];
 
     /* array of function pointers of return type readline*
      * CTRL + 'a' = -96 + 97 = 1
@@ -159,19 +207,31 @@ int main (int argc, char *argv[]) {
 
     /* init container */
     con.current_row     = 0;
-    con.max_row         = 1;
+    con.max_row         = 0;
     con.hpadding        = 0;
     con.vpadding        = 0;
-    con.row_length      = ROW_BLOCK_SIZE;
-    con.rows            = malloc(sizeof(struct readline) * ROW_BLOCK_SIZE);
+    con.rows            = lines_new();
     con.minibuffer_mode = FALSE;
     con.temp_row        = 0;
     con.buffer_filename = NULL;
+    con.damage_from     = 0;
+    con.damage_to       = SCREEN_END;
+    memset(&con.search, 0, sizeof(isearch));
+    con.replace         = NULL;
+    /* the editor holds the index lock except while it waits for a key */
+    trigram_init(&con.index, &con.rows);
+    trigram_lock(&con.index);
+    undo_init(&con.undo);
+    memset(&con.save, 0, sizeof(save_job));
+    save_init();
+    journal_init(&con.journal);
+    /* a file loading in the background appends under the same lock */
+    load_init(&con.load, &con.rows, &con.max_row, &con.index.lock);
 
     /* init yank line */
     readline  yank_line;
     readline *yank_line_pointer = &yank_line;
-    yank_line_pointer->buffer   = NULL;
+    make_new_row(yank_line_pointer);
 
     /* init minibuffer */
     readline  minibuffer;
@@ -179,28 +239,64 @@ int main (int argc, char *argv[]) {
     int       func_id;
 
     /* array of function pointers to minibuffer callback functions */
-    void (*minibuffer_callback[3])(container*, char[]);
-    minibuffer_callback[GOTO_FUNC]    = editor_goto_line;
-    minibuffer_callback[SAVE_FUNC]    = editor_save_file;
-    minibuffer_callback[SEARCHF_FUNC] = editor_search_forward;
+    void (*minibuffer_callback[6])(container*, char[]);
+    minibuffer_callback[GOTO_FUNC]         = editor_goto_line;
+    minibuffer_callback[SAVE_FUNC]         = editor_save_file;
+    minibuffer_callback[ISEARCH_FUNC]      = editor_isearch_finish;
+    minibuffer_callback[REPLACE_FUNC]      = editor_replace_compile;
+    minibuffer_callback[REPLACE_WITH_FUNC] = editor_replace_regexp;
+    minibuffer_callback[COUNT_FUNC]        = editor_count_matches;
 
     /* read input file */
     if (argc > 1) {
         con.buffer_filename = strdup(argv[1]);
         editor_load_file(&con, argv[1]);
         con.current_row = 0;
-        row_pointer = &con.rows[con.current_row];
+        row_pointer = container_row(&con, con.current_row);
     } else {
-        row_pointer = &con.rows[con.current_row];
-        make_new_row(row_pointer);
+        row_pointer = container_insert_row(&con, con.current_row);
     }
 
-    infobar_print(&con, "Welcome to mx! Press C-x C-c to quit.\0");
-    signal(SIGWINCH, win_resize_handler);
+    /* the loader reports its own statistics */
+    if (argc <= 1)
+        infobar_print(&con, "Welcome to mx! Press C-x C-c to quit.\0");
 
     /* main loop */
     while (1) {
-        unichar = getwchar();
+        /* the search follows every change of its query */
+        if (con.search.active)
+            editor_isearch_update(&con, minibuffer_pointer);
+        /* Everything drawn for the previous keys goes out at once. Keys
+         * typed ahead are applied first, a frame is drawn at least
+         * every INPUT_BATCH keys. */
+        if (batched < INPUT_BATCH && input_pending()) {
+            batched++;
+        } else {
+            screen_render(&con);
+            term_flush();
+            batched = 0;
+        }
+        trigram_unlock(&con.index);
+        /* while a file loads or saves the screen follows it until a
+         * key comes */
+        int ready = 1;
+        while ((con.load.loading || con.save.saving)
+               && (ready = input_wait(LOAD_TICK)) == 0) {
+            trigram_lock(&con.index);
+            editor_load_progress(&con);
+            editor_save_progress(&con);
+            screen_render(&con);
+            term_flush();
+            trigram_unlock(&con.index);
+        }
+        unichar = ready < 0 ? WEOF : input_read();
+        trigram_lock(&con.index);
+        if (unichar == KEY_HANGUP) goto HANGUP;
+        if (unichar == KEY_ERROR) {
+            infobar_error(&con, "Could not read input");
+            continue;
+        }
+        undo_command(&con.undo);
         if (WIN_RESIZED) {
             editor_page_center_cursor(&con, row_pointer, unichar);
             if (con.minibuffer_mode)
@@ -209,9 +305,6 @@ int main (int argc, char *argv[]) {
         }
         if (alt_modifier) {
             switch (unichar) {
-                case BRACKETLEFT:
-                    row_pointer = handle_arrow_keys(&con, row_pointer);
-                    break;
                 case ',':
                     row_pointer = editor_goto_beginning_of_document(
                             &con, row_pointer, unichar);
@@ -229,6 +322,25 @@ int main (int argc, char *argv[]) {
                                               minibuffer_pointer);
                     func_id = GOTO_FUNC;
                     break;
+                case KEY_CTRL + 's':
+                case KEY_CTRL + 'r':
+                    row_pointer = handle_isearch(&con, row_pointer, minibuffer_pointer,
+                                                 unichar == KEY_CTRL + 's', TRUE);
+                    if (con.search.active) func_id = ISEARCH_FUNC;
+                    break;
+                case '%':
+                    if (!con.minibuffer_mode) func_id = REPLACE_FUNC;
+                    row_pointer = handle_replace(&con, row_pointer,
+                                                 minibuffer_pointer);
+                    break;
+                case '_':
+                    row_pointer = editor_redo(&con, row_pointer, unichar);
+                    break;
+                case 'c':
+                    if (!con.minibuffer_mode) func_id = COUNT_FUNC;
+                    row_pointer = handle_count(&con, row_pointer,
+                                               minibuffer_pointer);
+                    break;
                 default:
                     unichar = KEY_CTRL + unichar;
                     if ((unichar > 0) && (unichar <= 26)) {
@@ -247,8 +359,12 @@ int main (int argc, char *argv[]) {
             switch (unichar) {
                 case KEY_CTRL + 'c':
                     infobar_print(&con, "Really quit? (y/n)\0");
-                    while ((unichar = getwchar())) {
+                    screen_render(&con);
+                    term_flush();
+                    while ((unichar = input_read())) {
                         if (unichar == 'y') goto QUIT;
+                        if (unichar == KEY_HANGUP) goto HANGUP;
+                        if (unichar == KEY_ERROR) break;
                         if (unichar == 'n') { infobar_erase(&con); break; }
                     }
                     break;
@@ -263,6 +379,18 @@ int main (int argc, char *argv[]) {
                 case '=':
                     infobar_print_position(&con);
                     break;
+                case 'i':
+                    infobar_print_index(&con);
+                    break;
+                case 'm':
+                    infobar_print_memory(&con);
+                    break;
+                case 't':
+                    editor_toggle_index(&con);
+                    break;
+                case 'u':
+                    row_pointer = editor_undo(&con, row_pointer, unichar);
+                    break;
                 default:
                     infobar_print(&con, "Unknown keybinding\0");
             }
@@ -288,14 +416,20 @@ int main (int argc, char *argv[]) {
                         infobar_print(&con, "ERROR: Minibuffer overflow\0");
                         break;
                     }
-                    sprintf(
-                        message,
-                        "%ls",
-                        &minibuffer_pointer->buffer[minibuffer_pointer->margin]
-                    );
+                    int length = minibuffer_pointer->line_end
+                                 - minibuffer_pointer->margin;
+                    row_copy_out(minibuffer_pointer, minibuffer_pointer->margin,
+                                 length, (wint_t *) wmessage);
+                    wmessage[length] = 0;
+                    wcstombs(message, wmessage, MINIBUFFER_LIMIT);
+                    message[MINIBUFFER_LIMIT-1] = 0;
                     (*minibuffer_callback[func_id])(&con, message);
-                    row_pointer = &con.rows[con.current_row];
-                    free(minibuffer_pointer->buffer);
+                    row_pointer = container_row(&con, con.current_row);
+                    free_row(minibuffer_pointer);
+                    if (func_id == REPLACE_FUNC && con.replace != NULL) {
+                        row_pointer = handle_replace_with(&con, minibuffer_pointer);
+                        func_id = REPLACE_WITH_FUNC;
+                    }
                 } else {
                     row_pointer = editor_newline(&con, row_pointer);
                 }
@@ -319,10 +453,47 @@ int main (int argc, char *argv[]) {
                 row_pointer = editor_yank_line(
                         &con, row_pointer, yank_line_pointer);
                 break;
+            case KEY_UNDO:
+                row_pointer = editor_undo(&con, row_pointer, unichar);
+                break;
+            case KEY_UP:
+                row_pointer = editor_move_previous_line(&con, row_pointer, unichar);
+                break;
+            case KEY_DOWN:
+                row_pointer = editor_move_next_line(&con, row_pointer, unichar);
+                break;
+            case KEY_RIGHT:
+                row_pointer = editor_forward_char(&con, row_pointer, unichar);
+                break;
+            case KEY_LEFT:
+                row_pointer = editor_backward_char(&con, row_pointer, unichar);
+                break;
+            case KEY_HOME:
+                row_pointer = editor_move_beginning_of_line(&con, row_pointer, unichar);
+                break;
+            case KEY_END:
+                row_pointer = editor_move_end_of_line(&con, row_pointer, unichar);
+                break;
+            case KEY_DELETE:
+                row_pointer = editor_delete_forward_char(&con, row_pointer, unichar);
+                break;
+            case KEY_PAGE_UP:
+                row_pointer = editor_page_up(&con, row_pointer, unichar);
+                break;
+            case KEY_PAGE_DOWN:
+                row_pointer = editor_page_down(&con, row_pointer, unichar);
+                break;
+            case KEY_PASTE_BEGIN:
+                row_pointer = handle_paste(&con, row_pointer);
+                break;
+            case KEY_PASTE_END:
+                break;
             case KEY_CTRL + 's':
-                row_pointer = handle_search_forward(&con, row_pointer,
-                                                    minibuffer_pointer);
-                func_id = SEARCHF_FUNC;
+            case KEY_CTRL + 'r':
+                row_pointer = handle_isearch(&con, row_pointer, minibuffer_pointer,
+                                             unichar == KEY_CTRL + 's', FALSE);
+                if (con.search.active) func_id = ISEARCH_FUNC;
+                break;
             default:
                 /* keybindings with ctrl modifier */
                 if ((unichar > 0) && (unichar <= 26)) {
@@ -341,14 +512,18 @@ int main (int argc, char *argv[]) {
     }
 
     QUIT:
+    editor_save_wait(&con);
+    journal_close(&con.journal, TRUE);
+    ANSI_PASTE_OFF;
     ANSI_RESET_SCREEN;
+    term_flush();
     /* restore terminal settings */
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    term_restore();
 
     if (DEBUG) {
-        for (short i = 0; i < LINE_LEN; i++) printf("%lc", BUFFER[i]);
+        for (short i = 0; i < LINE_END; i++) printf("%lc", row_get(row_pointer, i));
         printf("\n");
-        for (short i = 0; i < LINE_LEN; i++) printf("%d ", BUFFER[i]);
+        for (short i = 0; i < LINE_END; i++) printf("%d ", row_get(row_pointer, i));
         printf("\n");
         printf("current_row = %d\n", con.current_row);
         printf("max_row = %d\n", con.max_row);
@@ -358,12 +533,19 @@ int main (int argc, char *argv[]) {
         printf("vpadding = %d\n", con.vpadding);
         /* printf("win width %d\n",  w.ws_col); */
         /* printf("win height %d\n",  w.ws_row);     */
-        printf("row_length %d\n",  con.row_length);
         printf("margin %d\n",  MARGIN);
         printf("temp_row %d\n",  con.temp_row);
         printf("buffer_filename %s\n",  con.buffer_filename);
     }
     return 0;
+
+    HANGUP:
+    /* the terminal is gone, the edits that were not saved stay in the
+     * journal for the next session */
+    editor_save_wait(&con);
+    journal_close(&con.journal, FALSE);
+    term_restore();
+    return 1;
 }
 
 /* Emacs indentation: 
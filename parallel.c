@@ -0,0 +1,163 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "parallel.h"
+
+/* one search, shared by its workers */
+typedef struct job {
+    parallel_query *query;
+    line_node      *rows;
+    int             count;        /* rows in the document */
+    int             row;          /* first row of the first chunk */
+    int             from;         /* first character in that row */
+    int             chunks;
+    int             counting;
+    pthread_mutex_t lock;
+    pthread_mutex_t shared;       /* the regexp of the query */
+    int             next;         /* next chunk to hand out */
+    int             found;        /* first chunk with a match, or chunks */
+    search_match    match;
+    long            total;
+} job;
+
+int parallel_threads(void) {
+    static int threads = 0;
+    if (threads == 0) {
+        const char *env = getenv("MX_THREADS");
+        threads = env ? atoi(env) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1)                threads = 1;
+        if (threads > PARALLEL_THREADS) threads = PARALLEL_THREADS;
+    }
+    return threads;
+}
+
+static void *worker(void *arg) {
+    job *j = arg;
+    parallel_query *q = j->query;
+    regex *re = q->re;
+    int shared = 0;
+    if (q->pattern == NULL && j->chunks > 1) {
+        /* a worker without its own copy takes turns with the others on
+         * the one of the query */
+        re = regex_compile(q->regexp, q->regexp_length, q->fold, NULL);
+        if (re == NULL) {
+            re     = q->re;
+            shared = 1;
+        }
+    }
+    /* a match of a pattern with newlines reads rows behind the chunk,
+     * walking a chunk ends on the row behind it */
+    int reach = (q->pattern ? q->pattern->lines : 0) + 1;
+    long total = 0;
+    while (1) {
+        pthread_mutex_lock(&j->lock);
+        int c = j->next++;
+        int stop = c >= j->chunks || c > j->found;
+        int first = j->row + c * PARALLEL_CHUNK;
+        int last  = first + PARALLEL_CHUNK < j->count ? first + PARALLEL_CHUNK : j->count;
+        /* rows of a mapped file are paged in one chunk at a time, by
+         * the worker that takes it and while no other worker does */
+        if (!stop) lines_page_in(j->rows, first, last + reach);
+        pthread_mutex_unlock(&j->lock);
+        if (stop) break;
+
+        int from  = c == 0 ? j->from : 0;
+        if (shared) pthread_mutex_lock(&j->shared);
+        if (j->counting) {
+            total += re ? regex_count(re, j->rows, first, last, from)
+                        : search_count(q->pattern, j->rows, j->count, first, last, from);
+            if (shared) pthread_mutex_unlock(&j->shared);
+            continue;
+        }
+        search_match match;
+        int found = re ? regex_span(re, j->rows, first, last, from, &match)
+                       : search_span(q->pattern, j->rows, j->count, first, last, from, &match);
+        if (shared) pthread_mutex_unlock(&j->shared);
+        if (found) {
+            pthread_mutex_lock(&j->lock);
+            if (c < j->found) {
+                j->found = c;
+                j->match = match;
+            }
+            pthread_mutex_unlock(&j->lock);
+        }
+    }
+    pthread_mutex_lock(&j->lock);
+    j->total += total;
+    pthread_mutex_unlock(&j->lock);
+    if (re != q->re) regex_free(re);
+    return NULL;
+}
+
+/* runs the job on as many workers as there are chunks, up to the number
+ * of processors */
+static void run(job *j) {
+    pthread_t threads[PARALLEL_THREADS];
+    int n = parallel_threads();
+    if (n > j->chunks) n = j->chunks;
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_mutex_init(&j->shared, NULL);
+    j->next  = 0;
+    j->found = j->chunks;
+    j->total = 0;
+    /* the calling thread is a worker too */
+    int started = 0;
+    while (started < n - 1 && pthread_create(&threads[started], NULL, worker, j) == 0)
+        started++;
+    worker(j);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&j->lock);
+    pthread_mutex_destroy(&j->shared);
+}
+
+static void job_init(job *j, parallel_query *q, line_node *rows, int count,
+                     int row, int from) {
+    j->query  = q;
+    j->rows   = rows;
+    j->count  = count;
+    j->row    = row;
+    j->from   = from;
+    j->chunks = row < count ? (count - row + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK : 0;
+}
+
+/* Finds the first match at or after character from of row. Returns
+ * FALSE if there is none. */
+int parallel_forward(parallel_query *q, line_node *rows, int count,
+                     int row, int from, search_match *match) {
+    job j;
+    job_init(&j, q, rows, count, row, from);
+    j.counting = 0;
+    if (j.chunks == 0) return 0;
+    run(&j);
+    if (j.found == j.chunks) return 0;
+    *match = j.match;
+    return 1;
+}
+
+/* Counts the matches from character from of row to the end. */
+long parallel_count(parallel_query *q, line_node *rows, int count,
+                    int row, int from) {
+    job j;
+    job_init(&j, q, rows, count, row, from);
+    j.counting = 1;
+    if (j.chunks == 0) return 0;
+    run(&j);
+    return j.total;
+}
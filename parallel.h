@@ -0,0 +1,51 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_GUARD
+#define PARALLEL_GUARD
+
+#include "search.h"
+#include "regex.h"
+
+/* Rows handed to a worker at a time. A worker checks whether an
+ * earlier chunk has matched before it takes the next one. */
+#define PARALLEL_CHUNK 4096
+
+/* upper bound on the workers, MX_THREADS overrides the number of
+ * online processors */
+#define PARALLEL_THREADS 64
+
+/* Searches large documents on all processors. The rows after the
+ * cursor are cut into chunks that the workers take in order; the
+ * earliest chunk with a match wins and stops every worker busy with a
+ * later one. A query that fits in one chunk runs on the calling thread.
+ *
+ * A literal pattern is shared by the workers. The DFA cache of a regexp
+ * is not, every worker compiles its own copy from the source. */
+typedef struct parallel_query {
+    search_pattern *pattern;        /* NULL for a regexp */
+    regex          *re;             /* compiled by the caller */
+    const wint_t   *regexp;         /* source of re */
+    int             regexp_length;
+    int             fold;
+} parallel_query;
+
+int  parallel_threads (void);
+int  parallel_forward (parallel_query*, line_node*, int, int, int, search_match*);
+long parallel_count   (parallel_query*, line_node*, int, int, int);
+
+#endif /* PARALLEL_GUARD */
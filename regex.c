@@ -0,0 +1,880 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include "regex.h"
+
+#define MAX_CHAR 0x10FFFF
+
+/* no character beyond has a lower case form */
+#define MAX_UPPER 0x1FFFF
+
+/* largest count of a bounded repetition */
+#define MAX_REPEAT 1000
+
+/* largest NFA of a pattern */
+#define MAX_STATES 100000
+
+/*-----------------------------------------------  
+    parser
+ -----------------------------------------------*/
+
+enum node_type  { NODE_TEST, NODE_EMPTY, NODE_CAT, NODE_ALT,
+                  NODE_STAR, NODE_PLUS, NODE_QUEST };
+enum state_type { STATE_CHAR, STATE_SPLIT, STATE_MATCH };
+
+typedef struct node {
+    int type;
+    int left;
+    int right;
+    int test;
+    int size;        /* NFA states built from the node */
+} node;
+
+/* A test is a sorted list of disjoint character ranges. */
+typedef struct parser {
+    const wint_t *s;
+    int           length;
+    int           pos;
+    int           fold;
+    const char   *error;
+    node         *nodes;
+    int           node_count;
+    int          *range;         /* pairs of first and last character */
+    int           range_count;
+    int          *test_first;    /* first range of each test */
+    int          *test_ranges;   /* number of ranges of each test */
+    int           test_count;
+} parser;
+
+static int parse_alt(parser *p);
+
+/* A repeated node is built once for every reference to it, the size
+ * of the automaton is bounded by MAX_STATES. */
+static int new_node(parser *p, int type, int left, int right, int test) {
+    p->nodes = realloc(p->nodes, sizeof(node) * (p->node_count + 1));
+    node *n = &p->nodes[p->node_count];
+    n->type  = type;
+    n->left  = left;
+    n->right = right;
+    n->test  = test;
+    switch (type) {
+        case NODE_TEST:  n->size = 1; break;
+        case NODE_EMPTY: n->size = 0; break;
+        case NODE_CAT:   n->size = p->nodes[left].size + p->nodes[right].size; break;
+        case NODE_ALT:   n->size = 1 + p->nodes[left].size + p->nodes[right].size; break;
+        default:         n->size = 1 + p->nodes[left].size;
+    }
+    if (n->size > MAX_STATES && !p->error) p->error = "Regexp too big";
+    return p->node_count++;
+}
+
+static void add_range(int **ranges, int *count, int first, int last) {
+    *ranges = realloc(*ranges, sizeof(int) * 2 * (*count + 1));
+    (*ranges)[2 * *count]     = first;
+    (*ranges)[2 * *count + 1] = last;
+    (*count)++;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+/* Turns a list of ranges into a test. When folding every character of
+ * a range adds its towlower form, as the text is folded the same way.
+ * Identical tests are shared. */
+static int new_test(parser *p, int *ranges, int count, int negate) {
+    if (p->fold) {
+        for (int i = 0, n = count; i < n; i++) {
+            int last  = ranges[2*i+1] > MAX_UPPER ? MAX_UPPER : ranges[2*i+1];
+            int first = -1;
+            int prev  = -1;
+            for (int c = ranges[2*i]; c <= last; c++) {
+                int lower = towlower(c);
+                if (lower == c) continue;
+                if (lower != prev + 1) {
+                    if (first >= 0) add_range(&ranges, &count, first, prev);
+                    first = lower;
+                }
+                prev = lower;
+            }
+            if (first >= 0) add_range(&ranges, &count, first, prev);
+        }
+    }
+    qsort(ranges, count, 2 * sizeof(int), compare_ints);
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        if (merged && ranges[2*i] <= ranges[2*merged-1] + 1) {
+            if (ranges[2*i+1] > ranges[2*merged-1]) ranges[2*merged-1] = ranges[2*i+1];
+        } else {
+            ranges[2*merged]   = ranges[2*i];
+            ranges[2*merged+1] = ranges[2*i+1];
+            merged++;
+        }
+    }
+    count = merged;
+    if (negate) {
+        int *inverse = NULL;
+        int  n = 0;
+        int  next = 0;
+        for (int i = 0; i < count; i++) {
+            if (ranges[2*i] > next) add_range(&inverse, &n, next, ranges[2*i] - 1);
+            next = ranges[2*i+1] + 1;
+        }
+        if (next <= MAX_CHAR) add_range(&inverse, &n, next, MAX_CHAR);
+        free(ranges);
+        ranges = inverse;
+        count  = n;
+    }
+    for (int t = 0; t < p->test_count; t++) {
+        if (p->test_ranges[t] == count &&
+            !memcmp(&p->range[2 * p->test_first[t]], ranges, sizeof(int) * 2 * count)) {
+            free(ranges);
+            return t;
+        }
+    }
+    p->test_first  = realloc(p->test_first,  sizeof(int) * (p->test_count + 1));
+    p->test_ranges = realloc(p->test_ranges, sizeof(int) * (p->test_count + 1));
+    p->test_first [p->test_count] = p->range_count;
+    p->test_ranges[p->test_count] = count;
+    for (int i = 0; i < count; i++)
+        add_range(&p->range, &p->range_count, ranges[2*i], ranges[2*i+1]);
+    free(ranges);
+    return p->test_count++;
+}
+
+static int char_test(parser *p, wint_t c) {
+    int *ranges = NULL;
+    int  count  = 0;
+    if (p->fold) c = towlower(c);
+    add_range(&ranges, &count, c, c);
+    return new_test(p, ranges, count, 0);
+}
+
+/* ranges of \d, \w and \s, FALSE for other escapes */
+static int escape_ranges(wint_t c, int **ranges, int *count) {
+    switch (towlower(c)) {
+        case 'd':
+            add_range(ranges, count, '0', '9');
+            return 1;
+        case 'w':
+            add_range(ranges, count, '0', '9');
+            add_range(ranges, count, 'A', 'Z');
+            add_range(ranges, count, 'a', 'z');
+            add_range(ranges, count, '_', '_');
+            return 1;
+        case 's':
+            add_range(ranges, count, ' ', ' ');
+            add_range(ranges, count, '\t', '\t');
+            return 1;
+    }
+    return 0;
+}
+
+static wint_t escape_char(wint_t c) {
+    return c == 't' ? '\t' : c;
+}
+
+static int parse_class(parser *p) {
+    int *ranges = NULL;
+    int  count  = 0;
+    int  negate = 0;
+    if (p->pos < p->length && p->s[p->pos] == '^') {
+        negate = 1;
+        p->pos++;
+    }
+    int first = 1;
+    while (p->pos < p->length && (p->s[p->pos] != ']' || first)) {
+        wint_t lo = p->s[p->pos++];
+        first = 0;
+        if (lo == '\\' && p->pos < p->length) {
+            wint_t e = p->s[p->pos++];
+            if (escape_ranges(e, &ranges, &count)) continue;
+            lo = escape_char(e);
+        }
+        wint_t hi = lo;
+        if (p->pos + 1 < p->length && p->s[p->pos] == '-' && p->s[p->pos+1] != ']') {
+            hi = p->s[p->pos + 1];
+            p->pos += 2;
+            if (hi == '\\' && p->pos < p->length) hi = escape_char(p->s[p->pos++]);
+            if (hi < lo) {
+                p->error = "Invalid range";
+                break;
+            }
+        }
+        add_range(&ranges, &count, lo, hi);
+    }
+    if (p->pos >= p->length && !p->error) p->error = "Unmatched [";
+    p->pos++;
+    return new_test(p, ranges, count, negate);
+}
+
+static int parse_atom(parser *p) {
+    wint_t c = p->s[p->pos++];
+    int *ranges = NULL;
+    int  count  = 0;
+    switch (c) {
+        case '(': {
+            int n = parse_alt(p);
+            if (p->pos >= p->length || p->s[p->pos] != ')') {
+                if (!p->error) p->error = "Unmatched (";
+                return n;
+            }
+            p->pos++;
+            return n;
+        }
+        case '[':
+            return new_node(p, NODE_TEST, 0, 0, parse_class(p));
+        case '.':
+            add_range(&ranges, &count, 0, MAX_CHAR);
+            return new_node(p, NODE_TEST, 0, 0, new_test(p, ranges, count, 0));
+        case '*':
+        case '+':
+        case '?':
+            p->error = "Nothing to repeat";
+            return new_node(p, NODE_EMPTY, 0, 0, 0);
+        case '\\':
+            if (p->pos >= p->length) {
+                p->error = "Trailing backslash";
+                return new_node(p, NODE_EMPTY, 0, 0, 0);
+            }
+            c = p->s[p->pos++];
+            if (escape_ranges(c, &ranges, &count))
+                return new_node(p, NODE_TEST, 0, 0,
+                                new_test(p, ranges, count, iswupper(c)));
+            c = escape_char(c);
+    }
+    return new_node(p, NODE_TEST, 0, 0, char_test(p, c));
+}
+
+/* digits at the position of the parser, -1 if there are none */
+static int parse_number(parser *p) {
+    int n = -1;
+    while (p->pos < p->length && p->s[p->pos] >= '0' && p->s[p->pos] <= '9') {
+        n = (n < 0 ? 0 : 10 * n) + p->s[p->pos++] - '0';
+        if (n > MAX_REPEAT) n = MAX_REPEAT + 1;
+    }
+    return n;
+}
+
+/* Reads "{n}", "{n,}" or "{n,m}" behind an atom into min and max, max
+ * is -1 without a bound. Anything else is left as literal text. */
+static int parse_bounds(parser *p, int *min, int *max) {
+    int pos = p->pos++;
+    *min = parse_number(p);
+    *max = *min;
+    if (*min >= 0 && p->pos < p->length && p->s[p->pos] == ',') {
+        p->pos++;
+        *max = parse_number(p);
+    }
+    if (*min < 0 || p->pos >= p->length || p->s[p->pos] != '}') {
+        p->pos = pos;
+        return 0;
+    }
+    p->pos++;
+    if (*min > MAX_REPEAT || *max > MAX_REPEAT || (*max >= 0 && *max < *min))
+        p->error = "Invalid repetition";
+    return 1;
+}
+
+/* Repeats node n min to max times, without a bound if max is -1. The
+ * NFA is built from the node once for every reference to it. */
+static int repeat_node(parser *p, int n, int min, int max) {
+    int tail = -1;
+    if (max < 0) {
+        tail = new_node(p, NODE_STAR, n, 0, 0);
+    } else {
+        /* (a(a(a)?)?)? for the optional ones */
+        for (int i = min; i < max; i++)
+            tail = new_node(p, NODE_QUEST,
+                            tail < 0 ? n : new_node(p, NODE_CAT, n, tail, 0), 0, 0);
+    }
+    int r = tail;
+    for (int i = 0; i < min; i++)
+        r = r < 0 ? n : new_node(p, NODE_CAT, n, r, 0);
+    return r < 0 ? new_node(p, NODE_EMPTY, 0, 0, 0) : r;
+}
+
+static int parse_repeat(parser *p) {
+    int n = parse_atom(p);
+    while (p->pos < p->length && !p->error) {
+        wint_t c = p->s[p->pos];
+        if (c == '{') {
+            int min, max;
+            if (!parse_bounds(p, &min, &max)) break;
+            n = repeat_node(p, n, min, max);
+            continue;
+        }
+        if      (c == '*') n = new_node(p, NODE_STAR,  n, 0, 0);
+        else if (c == '+') n = new_node(p, NODE_PLUS,  n, 0, 0);
+        else if (c == '?') n = new_node(p, NODE_QUEST, n, 0, 0);
+        else break;
+        p->pos++;
+    }
+    return n;
+}
+
+static int parse_concat(parser *p) {
+    int n = -1;
+    while (p->pos < p->length && !p->error
+           && p->s[p->pos] != '|' && p->s[p->pos] != ')') {
+        int r = parse_repeat(p);
+        n = n < 0 ? r : new_node(p, NODE_CAT, n, r, 0);
+    }
+    return n < 0 ? new_node(p, NODE_EMPTY, 0, 0, 0) : n;
+}
+
+static int parse_alt(parser *p) {
+    int n = parse_concat(p);
+    while (p->pos < p->length && !p->error && p->s[p->pos] == '|') {
+        p->pos++;
+        n = new_node(p, NODE_ALT, n, parse_concat(p), 0);
+    }
+    return n;
+}
+
+/*-----------------------------------------------  
+    NFA
+ -----------------------------------------------*/
+
+static int new_state(regex *re, int type, int test, int out, int out1) {
+    re->type = realloc(re->type, sizeof(int) * (re->states + 1));
+    re->test = realloc(re->test, sizeof(int) * (re->states + 1));
+    re->out  = realloc(re->out,  sizeof(int) * (re->states + 1));
+    re->out1 = realloc(re->out1, sizeof(int) * (re->states + 1));
+    re->type[re->states] = type;
+    re->test[re->states] = test;
+    re->out [re->states] = out;
+    re->out1[re->states] = out1;
+    return re->states++;
+}
+
+/* Builds the states of node in front of next and returns the first
+ * one. The reversed automaton reads concatenations backwards. */
+static int build(regex *re, node *nodes, int n, int next, int reversed) {
+    node *nd = &nodes[n];
+    int s, body;
+    switch (nd->type) {
+        case NODE_TEST:
+            return new_state(re, STATE_CHAR, nd->test, next, -1);
+        case NODE_CAT:
+            if (reversed)
+                return build(re, nodes, nd->right, build(re, nodes, nd->left, next, 1), 1);
+            return build(re, nodes, nd->left, build(re, nodes, nd->right, next, 0), 0);
+        case NODE_ALT:
+            return new_state(re, STATE_SPLIT, 0,
+                             build(re, nodes, nd->left,  next, reversed),
+                             build(re, nodes, nd->right, next, reversed));
+        case NODE_STAR:
+            s = new_state(re, STATE_SPLIT, 0, -1, next);
+            body = build(re, nodes, nd->left, s, reversed);
+            re->out[s] = body;
+            return s;
+        case NODE_PLUS:
+            s = new_state(re, STATE_SPLIT, 0, -1, next);
+            body = build(re, nodes, nd->left, s, reversed);
+            re->out[s] = body;
+            return body;
+        case NODE_QUEST:
+            return new_state(re, STATE_SPLIT, 0,
+                             build(re, nodes, nd->left, next, reversed), next);
+    }
+    return next;
+}
+
+/*-----------------------------------------------  
+    character classes
+ -----------------------------------------------*/
+
+static int in_ranges(parser *p, int t, int c) {
+    int *r = &p->range[2 * p->test_first[t]];
+    for (int i = 0; i < p->test_ranges[t]; i++)
+        if (c >= r[2*i] && c <= r[2*i+1]) return 1;
+    return 0;
+}
+
+/* Cuts the code space at every range boundary and gives the pieces
+ * that all tests treat alike the same class. */
+static void build_classes(regex *re, parser *p) {
+    int *cuts  = malloc(sizeof(int) * (2 * p->range_count + 2));
+    int  ncuts = 0;
+    cuts[ncuts++] = 0;
+    for (int i = 0; i < p->range_count; i++) {
+        cuts[ncuts++] = p->range[2*i];
+        if (p->range[2*i+1] < MAX_CHAR) cuts[ncuts++] = p->range[2*i+1] + 1;
+    }
+    qsort(cuts, ncuts, sizeof(int), compare_ints);
+    int unique = 0;
+    for (int i = 0; i < ncuts; i++)
+        if (unique == 0 || cuts[i] != cuts[unique-1]) cuts[unique++] = cuts[i];
+
+    int   tests = p->test_count;
+    char *signature = malloc(tests > 0 ? tests : 1);
+    re->bounds      = cuts;
+    re->bound_count = unique;
+    re->bound_class = malloc(sizeof(int) * unique);
+    re->in_test     = NULL;
+    re->classes     = 0;
+    for (int b = 0; b < unique; b++) {
+        for (int t = 0; t < tests; t++) signature[t] = in_ranges(p, t, cuts[b]);
+        int k;
+        for (k = 0; k < re->classes; k++)
+            if (!memcmp(&re->in_test[k * tests], signature, tests)) break;
+        if (k == re->classes) {
+            re->in_test = realloc(re->in_test, (re->classes + 1) * (tests > 0 ? tests : 1));
+            memcpy(&re->in_test[k * tests], signature, tests);
+            re->classes++;
+        }
+        re->bound_class[b] = k;
+    }
+    free(signature);
+    re->tests = tests;
+}
+
+static int regex_class(regex *re, wint_t c) {
+    if (re->fold) c = towlower(c);
+    if (c < 128) return re->ascii_class[c];
+    int lo = 0;
+    int hi = re->bound_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (re->bounds[mid] <= (int) c) lo = mid;
+        else                            hi = mid - 1;
+    }
+    return re->bound_class[lo];
+}
+
+/*-----------------------------------------------  
+    lazy DFA
+ -----------------------------------------------*/
+
+#define HASH_SIZE (2 * REGEX_DFA_STATES)
+
+/* adds the states reachable from s without reading to re->set */
+static void closure(regex *re, int s, int *n) {
+    int top = 0;
+    re->stack[top++] = s;
+    while (top > 0) {
+        s = re->stack[--top];
+        if (s < 0 || re->mark[s] == re->generation) continue;
+        re->mark[s] = re->generation;
+        if (re->type[s] == STATE_SPLIT) {
+            re->stack[top++] = re->out1[s];
+            re->stack[top++] = re->out[s];
+        } else {
+            re->set[(*n)++] = s;
+        }
+    }
+}
+
+static unsigned hash_set(const int *set, int n) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < n; i++) h = (h ^ set[i]) * 16777619u;
+    return h;
+}
+
+static void dfa_flush(regex_dfa *d) {
+    for (int i = 0; i < d->count; i++) free(d->sets[i]);
+    for (int i = 0; i < HASH_SIZE; i++) d->hash[i] = -1;
+    d->count = 0;
+    d->start = -1;
+}
+
+/* the DFA state for the n NFA states in re->set */
+static int dfa_add(regex *re, regex_dfa *d, int n) {
+    qsort(re->set, n, sizeof(int), compare_ints);
+    unsigned h = hash_set(re->set, n) & (HASH_SIZE - 1);
+    for (; d->hash[h] >= 0; h = (h + 1) & (HASH_SIZE - 1)) {
+        int k = d->hash[h];
+        if (d->set_length[k] == n && !memcmp(d->sets[k], re->set, sizeof(int) * n))
+            return k;
+    }
+    if (d->count == REGEX_DFA_STATES) {
+        dfa_flush(d);
+        return dfa_add(re, d, n);
+    }
+    if (d->count == d->capacity) {
+        d->capacity = d->capacity ? 2 * d->capacity : 16;
+        d->sets       = realloc(d->sets,       sizeof(int *) * d->capacity);
+        d->set_length = realloc(d->set_length, sizeof(int)   * d->capacity);
+        d->accept     = realloc(d->accept,     d->capacity);
+        d->trans      = realloc(d->trans,      sizeof(int) * d->capacity * re->classes);
+    }
+    int k = d->count++;
+    d->sets[k] = malloc(sizeof(int) * (n > 0 ? n : 1));
+    memcpy(d->sets[k], re->set, sizeof(int) * n);
+    d->set_length[k] = n;
+    d->accept[k] = 0;
+    for (int i = 0; i < n; i++)
+        if (re->type[re->set[i]] == STATE_MATCH) d->accept[k] = 1;
+    for (int c = 0; c < re->classes; c++) d->trans[k * re->classes + c] = -1;
+    d->hash[h] = k;
+    return k;
+}
+
+static int dfa_start(regex *re, regex_dfa *d) {
+    if (d->start < 0) {
+        int n = 0;
+        re->generation++;
+        closure(re, d->nfa_start, &n);
+        d->start = dfa_add(re, d, n);
+    }
+    return d->start;
+}
+
+/* builds the transition of state k on class c */
+static int dfa_step(regex *re, regex_dfa *d, int k, int c) {
+    int n = 0;
+    re->generation++;
+    int *set = d->sets[k];
+    for (int i = 0; i < d->set_length[k]; i++) {
+        int s = set[i];
+        if (re->type[s] == STATE_CHAR && re->in_test[c * re->tests + re->test[s]])
+            closure(re, re->out[s], &n);
+    }
+    if (d->unanchored) closure(re, d->nfa_start, &n);
+    int count = d->count;
+    int next  = dfa_add(re, d, n);
+    /* unless a flush dropped state k */
+    if (d->count >= count) d->trans[k * re->classes + c] = next;
+    return next;
+}
+
+static void dfa_init(regex_dfa *d, int nfa_start, int unanchored) {
+    memset(d, 0, sizeof(regex_dfa));
+    d->hash = malloc(sizeof(int) * HASH_SIZE);
+    for (int i = 0; i < HASH_SIZE; i++) d->hash[i] = -1;
+    d->start      = -1;
+    d->nfa_start  = nfa_start;
+    d->unanchored = unanchored;
+}
+
+static void dfa_free(regex_dfa *d) {
+    dfa_flush(d);
+    free(d->sets);
+    free(d->set_length);
+    free(d->trans);
+    free(d->accept);
+    free(d->hash);
+}
+
+/*-----------------------------------------------  
+    compiling
+ -----------------------------------------------*/
+
+/* Compiles the pattern s of length len. Returns NULL and points error,
+ * unless it is NULL, to a message if it is not valid. */
+regex *regex_compile(const wint_t *s, int len, int fold, const char **error) {
+    parser p;
+    memset(&p, 0, sizeof(parser));
+    p.s    = s;
+    p.fold = fold;
+
+    regex *re = calloc(1, sizeof(regex));
+    re->fold = fold;
+    if (len > 0 && s[0] == '^') {
+        re->bol = 1;
+        p.pos   = 1;
+    }
+    /* a trailing $ anchors unless it is escaped */
+    if (len > p.pos && s[len-1] == '$') {
+        int escapes = 0;
+        while (len - 2 - escapes >= p.pos && s[len-2-escapes] == '\\') escapes++;
+        if (escapes % 2 == 0) {
+            re->eol = 1;
+            len--;
+        }
+    }
+    p.length = len;
+
+    int root = parse_alt(&p);
+    if (!p.error && p.pos < p.length) p.error = "Unmatched )";
+    if (p.error) {
+        if (error) *error = p.error;
+        free(p.nodes);
+        free(p.range);
+        free(p.test_first);
+        free(p.test_ranges);
+        free(re);
+        return NULL;
+    }
+
+    int match         = new_state(re, STATE_MATCH, 0, -1, -1);
+    int forward_start = build(re, p.nodes, root, match, 0);
+    int reverse_start = build(re, p.nodes, root, match, 1);
+
+    build_classes(re, &p);
+    for (int c = 0; c < 128; c++) {
+        int b = 0;
+        while (b + 1 < re->bound_count && re->bounds[b+1] <= c) b++;
+        re->ascii_class[c] = re->bound_class[b];
+    }
+    if (fold)
+        for (int c = 'A'; c <= 'Z'; c++) re->ascii_class[c] = re->ascii_class[c + 32];
+
+    re->mark  = calloc(re->states, sizeof(int));
+    re->stack = malloc(sizeof(int) * (2 * re->states + 2));
+    re->set   = malloc(sizeof(int) * re->states);
+    dfa_init(&re->forward, forward_start, 0);
+    dfa_init(&re->search,  forward_start, 1);
+    dfa_init(&re->reverse, reverse_start, !re->eol);
+    re->decoded = malloc(sizeof(wint_t) * REGEX_BLOCK);
+
+    free(p.nodes);
+    free(p.range);
+    free(p.test_first);
+    free(p.test_ranges);
+    return re;
+}
+
+void regex_free(regex *re) {
+    if (re == NULL) return;
+    dfa_free(&re->forward);
+    dfa_free(&re->search);
+    dfa_free(&re->reverse);
+    free(re->type);
+    free(re->test);
+    free(re->out);
+    free(re->out1);
+    free(re->bounds);
+    free(re->bound_class);
+    free(re->in_test);
+    free(re->mark);
+    free(re->stack);
+    free(re->set);
+    free(re->chars);
+    free(re->decoded);
+    free(re);
+}
+
+/*-----------------------------------------------  
+    matching
+ -----------------------------------------------*/
+
+/* Makes sure the classes of characters [i, i + REGEX_BLOCK) of the row
+ * are in re->chars, classifying on from i if it is outside of what is
+ * classified already. */
+static void classify(regex *re, int i) {
+    readline *row = re->row;
+    if (i < re->chars_first || i > re->chars_last)
+        re->chars_first = re->chars_last = i;
+    int from = re->chars_last;
+    int to   = i + REGEX_BLOCK < row->line_end ? i + REGEX_BLOCK : row->line_end;
+    if (from >= to) return;
+    if (row_is_ascii(row)) {
+        const unsigned char *text = (const unsigned char *) row->text;
+        for (int k = from; k < to; k++) re->chars[k] = re->ascii_class[text[k] & 127];
+    } else {
+        for (int at = from; at < to; at += REGEX_BLOCK) {
+            int n = to - at < REGEX_BLOCK ? to - at : REGEX_BLOCK;
+            row_copy_out(row, at, n, re->decoded);
+            for (int k = 0; k < n; k++) re->chars[at + k] = regex_class(re, re->decoded[k]);
+        }
+    }
+    re->chars_last = to;
+}
+
+static int next_state(regex *re, regex_dfa *d, int k, int c) {
+    int next = d->trans[k * re->classes + c];
+    return next >= 0 ? next : dfa_step(re, d, k, c);
+}
+
+/* the state of d for the NFA states of state k of another automaton */
+static int dfa_convert(regex *re, regex_dfa *d, regex_dfa *from, int k) {
+    int n = from->set_length[k];
+    memcpy(re->set, from->sets[k], sizeof(int) * n);
+    return dfa_add(re, d, n);
+}
+
+/* end of the longest match starting at start and ending by limit, -1
+ * if there is none */
+static int match_end(regex *re, int start, int limit) {
+    regex_dfa *d = &re->forward;
+    int n   = re->row->line_end;
+    int k   = dfa_start(re, d);
+    int end = d->accept[k] ? start : -1;
+    int i;
+    for (i = start; i < limit && d->set_length[k] > 0; i++) {
+        if (i >= re->chars_last) classify(re, i);
+        k = next_state(re, d, k, re->chars[i]);
+        if (d->accept[k]) end = i + 1;
+    }
+    if (re->eol) return i == n && d->accept[k] ? n : -1;
+    return end;
+}
+
+/* Leftmost start of a match at or after from, -1 if there is none.
+ * No match starting there ends behind limit.
+ *
+ * A forward DFA that may start a match at every position stops at the
+ * first end of a match, so every match starts before it. From there
+ * the automaton goes on without starting new matches until it dies:
+ * the last end it reaches bounds all matches that start in between.
+ * The reverse DFA run from that bound back to from then accepts at the
+ * start of each of them. A search costs the distance to where the
+ * automaton dies behind the first match rather than the rest of the
+ * row. */
+static int match_start(regex *re, int from, int *limit) {
+    int n = re->row->line_end;
+    regex_dfa *d = &re->search;
+    int k = dfa_start(re, d);
+    int i = from;
+    for (; !d->accept[k] && i < n; i++) {
+        if (i >= re->chars_last) classify(re, i);
+        k = next_state(re, d, k, re->chars[i]);
+    }
+    if (!d->accept[k]) return -1;
+    regex_dfa *f = &re->forward;
+    int bound = i;
+    k = dfa_convert(re, f, d, k);
+    for (; i < n && f->set_length[k] > 0; i++) {
+        if (i >= re->chars_last) classify(re, i);
+        k = next_state(re, f, k, re->chars[i]);
+        if (f->accept[k]) bound = i + 1;
+    }
+    d = &re->reverse;
+    k = dfa_start(re, d);
+    int first = d->accept[k] ? bound : -1;
+    for (i = bound - 1; i >= from; i--) {
+        k = next_state(re, d, k, re->chars[i]);
+        if (d->accept[k]) first = i;
+    }
+    *limit = bound;
+    return first;
+}
+
+/* Starts a search in row, whose classes of characters stay cached for
+ * regex_next until the next call. The row must not change meanwhile. */
+void regex_row(regex *re, readline *row) {
+    int n = row->line_end;
+    if (n > re->chars_length) {
+        re->chars_length = n;
+        re->chars = realloc(re->chars, sizeof(int) * n);
+    }
+    re->row         = row;
+    re->chars_first = re->chars_last = 0;
+}
+
+/* Finds the leftmost-longest match starting at or after character from
+ * of the row given to regex_row and stores its bounds in start and end.
+ * Returns FALSE if there is none. Stepping through the matches of a row
+ * classifies each character once. */
+int regex_next(regex *re, int from, int *start, int *end) {
+    int n = re->row->line_end;
+    if (from > n || (re->bol && from > 0)) return 0;
+
+    classify(re, from);
+    int first = -1;
+    int limit = n;
+    if (re->bol) {
+        first = 0;
+    } else if (re->eol) {
+        /* the reverse automaton starts at the end of the row and dies
+         * where no match can start any more */
+        for (int i = from; i < n; i = re->chars_last) classify(re, i);
+        regex_dfa *d = &re->reverse;
+        int k = dfa_start(re, d);
+        if (d->accept[k]) first = n;
+        for (int i = n - 1; i >= from; i--) {
+            k = next_state(re, d, k, re->chars[i]);
+            if (d->accept[k]) first = i;
+            else if (d->set_length[k] == 0) break;
+        }
+    } else {
+        first = match_start(re, from, &limit);
+    }
+    if (first < 0) return 0;
+    int last = match_end(re, first, limit);
+    if (last < 0) return 0;
+    *start = first;
+    *end   = last;
+    return 1;
+}
+
+/* the first match in row at or after character from, see regex_next */
+int regex_search_row(regex *re, readline *row, int from, int *start, int *end) {
+    regex_row(re, row);
+    return regex_next(re, from, start, end);
+}
+
+/* Finds the first match at or after character from of row, trying the
+ * following rows up to end - 1 from their start. Returns FALSE if there
+ * is none. */
+int regex_span(regex *re, line_node *rows, int row, int end, int from,
+               search_match *match) {
+    if (row >= end) return 0;
+    int start, stop;
+    line_iter iter;
+    readline *row_pointer = lines_iter_start(rows, row, &iter);
+    for (int r = row; r < end; r++, row_pointer = lines_iter_next(&iter)) {
+        if (regex_search_row(re, row_pointer, from, &start, &stop)) {
+            match->row    = r;
+            match->cursor = start;
+            return 1;
+        }
+        from = 0;
+    }
+    return 0;
+}
+
+/* Counts the matches in rows [row, end), from character from of the
+ * first one. Matches do not overlap, an empty one is followed by the
+ * next character. */
+long regex_count(regex *re, line_node *rows, int row, int end, int from) {
+    if (row >= end) return 0;
+    long total = 0;
+    int start, stop;
+    line_iter iter;
+    readline *row_pointer = lines_iter_start(rows, row, &iter);
+    for (int r = row; r < end; r++, row_pointer = lines_iter_next(&iter)) {
+        regex_row(re, row_pointer);
+        while (regex_next(re, from, &start, &stop)) {
+            total++;
+            from = stop > start ? stop : start + 1;
+        }
+        from = 0;
+    }
+    return total;
+}
+
+/* Finds the last match starting before character before of row.
+ * Returns FALSE if there is none. */
+int regex_backward(regex *re, line_node *rows, int count,
+                   int row, int before, search_match *match) {
+    if (row >= count) {
+        row    = count - 1;
+        before = INT_MAX;
+    }
+    int start, end;
+    for (int r = row; r >= 0; r--, before = INT_MAX) {
+        readline *row_pointer = lines_get(rows, r);
+        int last = -1;
+        regex_row(re, row_pointer);
+        for (int from = 0; regex_next(re, from, &start, &end)
+                           && start < before; from = start + 1)
+            last = start;
+        if (last >= 0) {
+            match->row    = r;
+            match->cursor = last;
+            return 1;
+        }
+    }
+    return 0;
+}
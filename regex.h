@@ -0,0 +1,100 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REGEX_GUARD
+#define REGEX_GUARD
+
+#include "lines.h"
+#include "search.h"
+
+/* Number of DFA states kept per automaton. When the cache is full it
+ * is emptied and built again from the current state, so memory stays
+ * bounded and every character still costs at most one new state. */
+#define REGEX_DFA_STATES 4096
+
+/* characters of a row classified at a time */
+#define REGEX_BLOCK 4096
+
+/* Regular expressions matched with lazily built DFAs, in time linear
+ * in the length of the row. Supported are literals, ".", "[...]" and
+ * "[^...]" with ranges, "\d", "\w", "\s", escapes, grouping, "|", "*",
+ * "+", "?", "{n}", "{n,}", "{n,m}", and "^" / "$" at the start / end of
+ * the pattern. Matches stay within a row and are leftmost-longest.
+ *
+ * The characters of a row are mapped to classes of characters that no
+ * part of the pattern can tell apart, so the transition tables stay
+ * small, and the classes are kept while the matches of a row are
+ * stepped through. A forward DFA finds where the first match ends, a
+ * reverse DFA scanning back from there the leftmost start of a match
+ * and a forward DFA from that start its end. */
+typedef struct regex_dfa {
+    int   **sets;        /* NFA states of each DFA state */
+    int    *set_length;
+    int    *trans;       /* next state per class, -1 if not built yet */
+    char   *accept;
+    int    *hash;        /* open addressing table of DFA states */
+    int     count;
+    int     capacity;
+    int     start;       /* -1 if not built yet */
+    int     unanchored;  /* every position may start a match */
+    int     nfa_start;
+} regex_dfa;
+
+typedef struct regex {
+    /* NFA of the pattern, forward and reversed */
+    int       *type;
+    int       *test;
+    int       *out;
+    int       *out1;
+    int        states;
+    /* character classes */
+    int        tests;
+    int        classes;
+    int        ascii_class[128];
+    int       *bounds;       /* intervals of the code space */
+    int       *bound_class;
+    int        bound_count;
+    char      *in_test;      /* tests * classes */
+    int        fold;
+    int        bol;          /* anchored with ^ */
+    int        eol;          /* anchored with $ */
+    regex_dfa  forward;
+    regex_dfa  search;       /* forward, a match may start anywhere */
+    regex_dfa  reverse;
+    /* work space */
+    int       *mark;
+    int        generation;
+    int       *stack;
+    int       *set;
+    readline  *row;          /* searched by regex_next */
+    int       *chars;        /* class of each character of the row */
+    int        chars_length;
+    int        chars_first;  /* classified are [chars_first, chars_last) */
+    int        chars_last;
+    wint_t    *decoded;      /* REGEX_BLOCK characters */
+} regex;
+
+regex *regex_compile    (const wint_t*, int, int, const char**);
+void   regex_free       (regex*);
+void   regex_row        (regex*, readline*);
+int    regex_next       (regex*, int, int*, int*);
+int    regex_search_row (regex*, readline*, int, int*, int*);
+int    regex_span       (regex*, line_node*, int, int, int, search_match*);
+int    regex_backward   (regex*, line_node*, int, int, int, search_match*);
+long   regex_count      (regex*, line_node*, int, int, int);
+
+#endif /* REGEX_GUARD */
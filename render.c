@@ -0,0 +1,161 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "row.h"
+#include "term.h"
+#include "render.h"
+
+static wint_t *shadow;       /* WEOF where the contents are unknown */
+static int     shadow_rows;
+static int     shadow_cols;
+static int     term_row;     /* terminal cursor while rendering, */
+static int     term_col;     /* -1 if unknown */
+static int     saved;        /* cursor saved with DECSC in this frame */
+static int     attr;         /* attribute the terminal draws with */
+
+/* escape sequence selecting each attribute */
+static const char *attr_sequence[] = { "\033[m", "\033[0;4m", "\033[0;7m" };
+
+int render_begin(int rows, int cols) {
+    term_row = -1;
+    term_col = -1;
+    saved    = 0;
+    attr     = 0;
+    if (rows < 0) rows = 0;
+    if (cols < 0) cols = 0;
+    if (shadow != NULL && rows == shadow_rows && cols == shadow_cols)
+        return 0;
+    /* after a resize the terminal contents are unknown */
+    shadow_rows = rows;
+    shadow_cols = cols;
+    shadow = realloc(shadow, (rows * cols + 1) * sizeof(wint_t));
+    for (int i = 0; i < rows * cols; i++) shadow[i] = WEOF;
+    return 1;
+}
+
+/* the first output of a frame saves the cursor position of the editor */
+static void render_save(void) {
+    if (saved) return;
+    term_puts("\0337");
+    saved = 1;
+}
+
+static void render_attr(int a) {
+    if (a == attr) return;
+    term_puts(attr_sequence[a >> RENDER_ATTR_SHIFT]);
+    attr = a;
+}
+
+static int utf8_length(wint_t c) {
+    char out[4];
+    return c < 0x80 ? 1 : utf8_encode(c, out);
+}
+
+/* Moves the terminal cursor with the shortest sequence at hand:
+ * carriage return, line feed, repeating the cells in between,
+ * cursor forward or an absolute position. */
+static void render_move(int row, int col) {
+    if (row == term_row && col == term_col) return;
+    char absolute[32];
+    int  cost = snprintf(absolute, sizeof(absolute), "\033[%d;%dH", row+1, col+1);
+
+    if (term_row < 0) {
+        term_write(absolute, cost);
+    } else if (col == 0 && row == term_row) {
+        term_write("\r", 1);
+    } else if (col == 0 && row == term_row + 1) {
+        term_write("\r\n", 2);
+    } else if (row == term_row && col > term_col) {
+        wint_t *line = &shadow[row * shadow_cols];
+        int gap = 0;
+        for (int c = term_col; c < col && gap < cost; c++)
+            gap += (line[c] == WEOF || (line[c] & RENDER_ATTRS) != attr)
+                 ? cost : utf8_length(line[c]);
+        if (gap < cost) {
+            for (int c = term_col; c < col; c++) term_putwc(line[c] & ~RENDER_ATTRS);
+        } else {
+            char forward[16];
+            int  n = snprintf(forward, sizeof(forward), "\033[%dC", col - term_col);
+            if (n < cost) term_write(forward, n);
+            else          term_write(absolute, cost);
+        }
+    } else {
+        term_write(absolute, cost);
+    }
+    term_row = row;
+    term_col = col;
+}
+
+/* Scrolls the rows of the grid by n, up for n > 0 and down for n < 0,
+ * with a scroll region covering only the grid. The terminal moves the
+ * rows that stay visible, only the exposed ones are drawn afterwards. */
+void render_scroll(int n) {
+    int k = n < 0 ? -n : n;
+    if (k == 0 || k >= shadow_rows) return;
+    render_save();
+    render_attr(0);
+    /* setting the region homes the cursor */
+    term_printf("\033[1;%dr", shadow_rows);
+    term_printf(n > 0 ? "\033[%dM" : "\033[%dL", k);
+    term_puts("\033[r");
+    term_row = 0;
+    term_col = 0;
+
+    int keep = (shadow_rows - k) * shadow_cols;
+    if (n > 0) {
+        memmove(shadow, &shadow[k * shadow_cols], keep * sizeof(wint_t));
+        for (int i = keep; i < shadow_rows * shadow_cols; i++) shadow[i] = ' ';
+    } else {
+        memmove(&shadow[k * shadow_cols], shadow, keep * sizeof(wint_t));
+        for (int i = 0; i < k * shadow_cols; i++) shadow[i] = ' ';
+    }
+}
+
+void render_row(int row, const wint_t *cells, int n) {
+    if (row < 0 || row >= shadow_rows) return;
+    if (n > shadow_cols) n = shadow_cols;
+    wint_t *line = &shadow[row * shadow_cols];
+    /* the row is blank from here on */
+    int blank = n;
+    while (blank > 0 && cells[blank-1] == ' ') blank--;
+
+    for (int c = 0; c < blank; c++) {
+        if (line[c] == cells[c]) continue;
+        render_save();
+        render_move(row, c);
+        render_attr(cells[c] & RENDER_ATTRS);
+        term_putwc(cells[c] & ~RENDER_ATTRS);
+        line[c] = cells[c];
+        term_col++;
+    }
+    for (int c = blank; c < shadow_cols; c++) {
+        if (line[c] == ' ') continue;
+        render_save();
+        render_move(row, blank);
+        render_attr(0);
+        term_puts("\033[K");
+        for (c = blank; c < shadow_cols; c++) line[c] = ' ';
+    }
+}
+
+void render_end(void) {
+    render_attr(0);
+    if (saved) term_puts("\0338");
+}
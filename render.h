@@ -0,0 +1,44 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENDER_GUARD
+#define RENDER_GUARD
+
+#include <wchar.h>
+
+/* The renderer keeps a shadow grid of what the terminal shows and
+ * sends only the cells of a new frame that differ from it.
+ *
+ * render_begin  starts a frame of the given size, TRUE if the size
+ *               changed and every row has to be passed again
+ * render_scroll moves the rows of the grid up (n > 0) or down (n < 0)
+ *               on the terminal itself
+ * render_row    compares one row, cells beyond n are blank
+ * render_end    puts the terminal cursor back where the editor left it
+ *
+ * The bits above the character of a cell select its attribute. */
+#define RENDER_ATTR_SHIFT 24
+#define RENDER_MATCH      (1 << RENDER_ATTR_SHIFT)   /* underlined */
+#define RENDER_CURRENT    (2 << RENDER_ATTR_SHIFT)   /* inverted */
+#define RENDER_ATTRS      (3 << RENDER_ATTR_SHIFT)
+
+int  render_begin (int, int);
+void render_scroll(int);
+void render_row   (int, const wint_t*, int);
+void render_end   (void);
+
+#endif /* RENDER_GUARD */
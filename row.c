@@ -0,0 +1,784 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "row.h"
+
+#define GAP_SIZE(row) ((row)->line_length - (row)->line_end)
+
+/* chunked mode, see the end of the file */
+static void chunks_load      (readline*, const char*, int);
+static void chunks_make      (readline*);
+static void chunks_join      (readline*);
+static int  chunks_find      (readline*, int);
+static int  chunks_find_column(readline*, int);
+static void chunks_columns   (readline*);
+static void chunks_insert_n  (readline*, int, const wint_t*, int);
+static void chunks_delete    (readline*, int, int);
+static void chunks_append    (readline*, readline*, int);
+static void chunks_free      (readline*);
+
+void make_new_row(readline *row) {
+    row->cursor      = 0;
+    row->line_end    = 0;
+    row->margin      = 0;
+    row->gap         = 0;
+    row->line_length = 0;
+    row->buffer      = NULL;
+    row->text        = NULL;
+    row->text_length = 0;
+    row->index       = NULL;
+    row->tabs        = NULL;
+    row->tab_count   = 0;
+    row->shared      = 0;
+    row->chunks      = NULL;
+}
+
+/* bytes of the character index of a compact row */
+static size_t row_index_size(readline *row) {
+    return sizeof(int) * (row->line_end / ROW_INDEX_STRIDE + 1);
+}
+
+void free_row(readline *row) {
+    slab_free(row->buffer, sizeof(wint_t) * row->line_length);
+    if (!row->shared) slab_text_free(row->text, row->text_length);
+    if (row->index) slab_free(row->index, row_index_size(row));
+    free(row->tabs);
+    if (row->chunks) chunks_free(row);
+    row->buffer      = NULL;
+    row->text        = NULL;
+    row->index       = NULL;
+    row->tabs        = NULL;
+    row->tab_count   = 0;
+    row->shared      = 0;
+    row->text_length = 0;
+    row->line_end    = 0;
+    row->line_length = 0;
+    row->gap         = 0;
+}
+
+/*-----------------------------------------------  
+    UTF-8 conversion
+ -----------------------------------------------*/
+
+/* Decodes one character of at most n bytes into *c and returns the
+ * number of bytes used. Malformed input decodes to U+FFFD, one byte
+ * at a time. */
+int utf8_decode(const unsigned char *s, int n, wint_t *c) {
+    int len;
+    wint_t min;
+    if (s[0] < 0x80) {
+        *c = s[0];
+        return 1;
+    }
+    if      ((s[0] & 0xE0) == 0xC0) { len = 2; *c = s[0] & 0x1F; min = 0x80;    }
+    else if ((s[0] & 0xF0) == 0xE0) { len = 3; *c = s[0] & 0x0F; min = 0x800;   }
+    else if ((s[0] & 0xF8) == 0xF0) { len = 4; *c = s[0] & 0x07; min = 0x10000; }
+    else goto INVALID;
+    if (len > n) goto INVALID;
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) goto INVALID;
+        *c = (*c << 6) | (s[i] & 0x3F);
+    }
+    if (*c < min || *c > 0x10FFFF || (*c >= 0xD800 && *c <= 0xDFFF))
+        goto INVALID;
+    return len;
+    INVALID:
+    *c = 0xFFFD;
+    return 1;
+}
+
+/* TRUE if none of the n bytes of s has the high bit set. Tests eight
+ * bytes at a time. */
+int utf8_is_ascii(const unsigned char *s, int n) {
+    const uint64_t high = 0x8080808080808080ULL;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, &s[i], 8);
+        if (word & high) return 0;
+    }
+    for (; i < n; i++)
+        if (s[i] >= 0x80) return 0;
+    return 1;
+}
+
+/* Encodes c into out and returns the number of bytes written. */
+int utf8_encode(wint_t c, char *out) {
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xC0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = 0xE0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    if (c > 0x10FFFF) return 0;
+    out[0] = 0xF0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3F);
+    out[2] = 0x80 | ((c >> 6) & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+/*-----------------------------------------------  
+    compact mode
+ -----------------------------------------------*/
+
+/* makes row a compact row over the n UTF-8 bytes at text */
+static void row_compact(readline *row, char *text, int n) {
+    const unsigned char *u = (const unsigned char *) text;
+    row->text        = text;
+    row->text_length = n;
+
+    if (memchr(text, 0x9, n) != NULL) row->tab_count = -1;
+    if (utf8_is_ascii(u, n)) {
+        row->line_end = n;
+        return;
+    }
+
+    int chars    = 0;
+    int capacity = n / ROW_INDEX_STRIDE + 1;
+    int *index   = slab_alloc(sizeof(int) * capacity);
+    for (int b = 0; b < n; chars++) {
+        wint_t c;
+        if (chars % ROW_INDEX_STRIDE == 0)
+            index[chars / ROW_INDEX_STRIDE] = b;
+        if (u[b] < 0x80) b++;
+        else             b += utf8_decode(&u[b], n - b, &c);
+    }
+    row->line_end = chars;
+    row->index    = slab_resize(index, sizeof(int) * capacity, row_index_size(row));
+}
+
+/* Makes row a compact row holding the n UTF-8 bytes of s. */
+void row_load_utf8(readline *row, const char *s, int n) {
+    free_row(row);
+    if (n == 0) return;
+    if (n > ROW_LONG) {
+        chunks_load(row, s, n);
+        return;
+    }
+    char *text = slab_text_alloc(n);
+    memcpy(text, s, n);
+    row_compact(row, text, n);
+}
+
+/* Makes row a compact row reading the n UTF-8 bytes at s in place.
+ * They are never written and have to outlive the row. Lines too long
+ * for one compact row are copied into pieces. */
+void row_map_utf8(readline *row, const char *s, int n) {
+    free_row(row);
+    if (n == 0) return;
+    if (n > ROW_LONG) {
+        chunks_load(row, s, n);
+        return;
+    }
+    row->shared = 1;
+    row_compact(row, (char *) s, n);
+}
+
+/* byte offset of character i of a compact row */
+int row_seek(readline *row, int i) {
+    if (row->index == NULL) return i;
+    const unsigned char *u = (const unsigned char *) row->text;
+    int b = row->index[i / ROW_INDEX_STRIDE];
+    for (int k = i % ROW_INDEX_STRIDE; k > 0; k--) {
+        wint_t c;
+        b += utf8_decode(&u[b], row->text_length - b, &c);
+    }
+    return b;
+}
+
+/* character index of the character starting at byte b of a compact row */
+int row_seek_char(readline *row, int b) {
+    if (row->index == NULL) return b;
+    const unsigned char *u = (const unsigned char *) row->text;
+    int lo = 0;
+    int hi = (row->line_end - 1) / ROW_INDEX_STRIDE;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (row->index[mid] <= b) lo = mid;
+        else                      hi = mid - 1;
+    }
+    int i = lo * ROW_INDEX_STRIDE;
+    for (int k = row->index[lo]; k < b; i++) {
+        wint_t c;
+        k += utf8_decode(&u[k], row->text_length - k, &c);
+    }
+    return i;
+}
+
+/* character i of a compact or chunked row */
+wint_t row_get_compact(readline *row, int i) {
+    if (row->chunks != NULL) {
+        row_chunk *p = &row->chunks->piece[chunks_find(row, i)];
+        return row_get(&p->row, i - p->start);
+    }
+    int b = row_seek(row, i);
+    wint_t c;
+    utf8_decode((const unsigned char *) &row->text[b], row->text_length - b, &c);
+    return c;
+}
+
+/* Converts a compact row into a gap buffer so that it can be edited. */
+void row_thaw(readline *row) {
+    if (row->buffer != NULL || row->chunks != NULL) return;
+    /* the buffer fills its size class */
+    int length = slab_round(sizeof(wint_t) * (row->line_end + LINE_BLOCK_SIZE))
+                 / sizeof(wint_t);
+    wint_t *buffer = slab_alloc(sizeof(wint_t) * length);
+    row_copy_out(row, 0, row->line_end, buffer);
+    if (!row->shared) slab_text_free(row->text, row->text_length);
+    if (row->index) slab_free(row->index, row_index_size(row));
+    row->shared      = 0;
+    row->text        = NULL;
+    row->index       = NULL;
+    row->text_length = 0;
+    row->buffer      = buffer;
+    row->line_length = length;
+    row->gap         = row->line_end;
+}
+
+/*-----------------------------------------------  
+    display columns
+ -----------------------------------------------*/
+
+/* collect the positions of all tabs in the row */
+static void row_map_tabs(readline *row) {
+    wint_t chunk[1024];
+    int capacity = 8;
+    row->tabs      = malloc(sizeof(int) * capacity);
+    row->tab_count = 0;
+    for (int from = 0; from < row->line_end; from += 1024) {
+        int n = row->line_end - from;
+        if (n > 1024) n = 1024;
+        row_copy_out(row, from, n, chunk);
+        for (int i = 0; i < n; i++) {
+            if (chunk[i] != 0x9) continue;
+            if (row->tab_count == capacity) {
+                capacity *= 2;
+                row->tabs = realloc(row->tabs, sizeof(int) * capacity);
+            }
+            row->tabs[row->tab_count++] = from + i;
+        }
+    }
+}
+
+/* number of the first tab at or behind position pos */
+static int row_first_tab(readline *row, int pos) {
+    int low = 0, high = row->tab_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (row->tabs[mid] < pos) low = mid + 1;
+        else                      high = mid;
+    }
+    return low;
+}
+
+/* the n characters at pos were just inserted into the gap buffer */
+static void row_tabs_inserted(readline *row, int pos, int n) {
+    if (row->tab_count < 0) return;
+    int k = row_first_tab(row, pos);
+    int added = 0;
+    for (int i = row->gap - n; i < row->gap; i++)
+        if (row->buffer[i] == 0x9) added++;
+    for (int j = k; j < row->tab_count; j++)
+        row->tabs[j] += n;
+    if (added == 0) return;
+    row->tabs = realloc(row->tabs, sizeof(int) * (row->tab_count + added));
+    memmove(&row->tabs[k + added], &row->tabs[k],
+            (row->tab_count - k) * sizeof(int));
+    for (int i = row->gap - n; i < row->gap; i++)
+        if (row->buffer[i] == 0x9) row->tabs[k++] = i;
+    row->tab_count += added;
+}
+
+/* the n characters at pos are about to be deleted */
+static void row_tabs_deleted(readline *row, int pos, int n) {
+    if (row->tab_count < 0) return;
+    int k = row_first_tab(row, pos);
+    int end = row_first_tab(row, pos + n);
+    for (int j = end; j < row->tab_count; j++)
+        row->tabs[j - (end - k)] = row->tabs[j] - n;
+    row->tab_count -= end - k;
+}
+
+/* display column of character i when the row starts at column column */
+static int row_column_from(readline *row, int column, int i) {
+    if (row->tab_count < 0) row_map_tabs(row);
+    int prev = 0;
+    for (int k = 0; k < row->tab_count && row->tabs[k] < i; k++) {
+        column += row->tabs[k] - prev;
+        column  = (column/TAB_STOP_WIDTH + 1) * TAB_STOP_WIDTH;
+        prev    = row->tabs[k] + 1;
+    }
+    return column + i - prev;
+}
+
+/* position of the character covering display column column when the
+ * row starts at column col */
+static int row_index_from(readline *row, int col, int column) {
+    if (row->tab_count < 0) row_map_tabs(row);
+    int prev = 0;
+    for (int k = 0; k < row->tab_count; k++) {
+        int start = col + row->tabs[k] - prev;
+        if (start > column) break;
+        col  = (start/TAB_STOP_WIDTH + 1) * TAB_STOP_WIDTH;
+        prev = row->tabs[k] + 1;
+        if (column < col) return row->tabs[k];
+    }
+    int i = prev + column - col;
+    return (i > row->line_end) ? row->line_end : i;
+}
+
+/* display column of character i */
+int row_column(readline *row, int i) {
+    if (row->chunks != NULL) {
+        chunks_columns(row);
+        row_chunk *p = &row->chunks->piece[chunks_find(row, i)];
+        return row_column_from(&p->row, p->column, i - p->start);
+    }
+    return row_column_from(row, 0, i);
+}
+
+/* position of the character covering display column column */
+int row_index(readline *row, int column) {
+    if (row->chunks != NULL) {
+        row_chunk *p = &row->chunks->piece[chunks_find_column(row, column)];
+        return p->start + row_index_from(&p->row, p->column, column);
+    }
+    return row_index_from(row, 0, column);
+}
+
+/*-----------------------------------------------  
+    wide mode
+ -----------------------------------------------*/
+
+/* Make room for at least n more characters. Grows geometrically so
+ * that a sequence of inserts costs amortized O(1) per character. */
+static void row_reserve(readline *row, int n) {
+    row_thaw(row);
+    if (GAP_SIZE(row) >= n) return;
+    int tail = row->line_end - row->gap;
+    int old_length = row->line_length;
+    int new_length = old_length * 2;
+    if (new_length < LINE_BLOCK_SIZE) new_length = LINE_BLOCK_SIZE;
+    if (new_length < row->line_end + n) new_length = row->line_end + n;
+    new_length  = slab_round(sizeof(wint_t) * new_length) / sizeof(wint_t);
+    row->buffer = slab_resize(row->buffer, sizeof(wint_t) * old_length,
+                              sizeof(wint_t) * new_length);
+    memmove(&row->buffer[new_length - tail],
+            &row->buffer[old_length - tail],
+            tail * sizeof(wint_t));
+    row->line_length = new_length;
+}
+
+/* move the gap so that it starts at position pos */
+static void row_move_gap(readline *row, int pos) {
+    int gap_size = GAP_SIZE(row);
+    if (pos < row->gap) {
+        memmove(&row->buffer[pos + gap_size],
+                &row->buffer[pos],
+                (row->gap - pos) * sizeof(wint_t));
+    } else if (pos > row->gap) {
+        memmove(&row->buffer[row->gap],
+                &row->buffer[row->gap + gap_size],
+                (pos - row->gap) * sizeof(wint_t));
+    }
+    row->gap = pos;
+}
+
+void row_insert(readline *row, int pos, wint_t c) {
+    if (row->chunks != NULL || row->line_end >= ROW_LONG) {
+        row_insert_n(row, pos, &c, 1);
+        return;
+    }
+    row_reserve(row, 1);
+    row_move_gap(row, pos);
+    row->buffer[row->gap++] = c;
+    row->line_end++;
+    row_tabs_inserted(row, pos, 1);
+}
+
+void row_insert_n(readline *row, int pos, const wint_t *s, int n) {
+    if (n <= 0) return;
+    if (row->chunks == NULL && row->line_end + n > ROW_LONG) chunks_make(row);
+    if (row->chunks != NULL) {
+        chunks_insert_n(row, pos, s, n);
+        return;
+    }
+    row_reserve(row, n);
+    row_move_gap(row, pos);
+    memcpy(&row->buffer[row->gap], s, n * sizeof(wint_t));
+    row->gap      += n;
+    row->line_end += n;
+    row_tabs_inserted(row, pos, n);
+}
+
+/* delete n characters starting at pos; the gap simply swallows them */
+void row_delete(readline *row, int pos, int n) {
+    if (pos < 0) pos = 0;
+    if (pos + n > row->line_end) n = row->line_end - pos;
+    if (n <= 0) return;
+    if (row->chunks != NULL) {
+        chunks_delete(row, pos, n);
+        /* a line that shrank well below the limit is made whole again */
+        if (row->line_end < ROW_LONG / 2) chunks_join(row);
+        return;
+    }
+    row_thaw(row);
+    row_tabs_deleted(row, pos, n);
+    row_move_gap(row, pos);
+    row->line_end -= n;
+}
+
+void row_truncate(readline *row, int pos) {
+    row_delete(row, pos, row->line_end - pos);
+}
+
+/* append the characters of src starting at from to the end of row */
+void row_append(readline *row, readline *src, int from) {
+    int n = src->line_end - from;
+    if (n <= 0) return;
+    if (row->chunks == NULL && row->line_end + n > ROW_LONG) chunks_make(row);
+    if (row->chunks != NULL) {
+        chunks_append(row, src, from);
+        return;
+    }
+    row_reserve(row, n);
+    row_move_gap(row, row->line_end);
+    row_copy_out(src, from, n, &row->buffer[row->gap]);
+    row->gap      += n;
+    row->line_end += n;
+    row_tabs_inserted(row, row->line_end - n, n);
+}
+
+/*-----------------------------------------------  
+    reading rows in bulk
+ -----------------------------------------------*/
+
+/* copy the n characters starting at from into dest */
+void row_copy_out(readline *row, int from, int n, wint_t *dest) {
+    if (row->chunks != NULL) {
+        int k = chunks_find(row, from);
+        for (from -= row->chunks->piece[k].start; n > 0; k++, from = 0) {
+            readline *piece = &row->chunks->piece[k].row;
+            int m = piece->line_end - from;
+            if (m > n) m = n;
+            row_copy_out(piece, from, m, dest);
+            dest += m;
+            n    -= m;
+        }
+        return;
+    }
+    if (row->buffer == NULL) {
+        const unsigned char *u = (const unsigned char *) row->text;
+        if (row->index == NULL) {
+            for (int k = 0; k < n; k++) dest[k] = u[from + k];
+            return;
+        }
+        int b = row_seek(row, from);
+        for (int k = 0; k < n; k++)
+            b += utf8_decode(&u[b], row->text_length - b, &dest[k]);
+        return;
+    }
+    int front = row->gap - from;
+    if (front > n) front = n;
+    if (front > 0) {
+        memcpy(dest, &row->buffer[from], front * sizeof(wint_t));
+        dest += front;
+        from += front;
+        n    -= front;
+    }
+    if (n > 0)
+        memcpy(dest, &row->buffer[from + GAP_SIZE(row)], n * sizeof(wint_t));
+}
+
+/* Encodes n characters starting at from as UTF-8 into out, which must
+ * have room for 4 * n bytes. Returns the number of bytes written.
+ * Compact rows are copied as they were read. */
+int row_encode(readline *row, int from, int n, char *out) {
+    if (row->chunks != NULL) {
+        char *start = out;
+        int k = chunks_find(row, from);
+        for (from -= row->chunks->piece[k].start; n > 0; k++, from = 0) {
+            readline *piece = &row->chunks->piece[k].row;
+            int m = piece->line_end - from;
+            if (m > n) m = n;
+            out += row_encode(piece, from, m, out);
+            n   -= m;
+        }
+        return out - start;
+    }
+    if (row->buffer == NULL) {
+        int b = row_seek(row, from);
+        int e = from + n < row->line_end
+              ? row_seek(row, from + n) : row->text_length;
+        memcpy(out, &row->text[b], e - b);
+        return e - b;
+    }
+    char *start = out;
+    for (int part = 0; part < 2 && n > 0; part++) {
+        const wint_t *s;
+        int k;
+        if (from < row->gap) {
+            s = &row->buffer[from];
+            k = row->gap - from;
+        } else {
+            s = &row->buffer[from + GAP_SIZE(row)];
+            k = row->line_end - from;
+        }
+        if (k > n) k = n;
+        for (int j = 0; j < k; j++) {
+            if (s[j] < 0x80) *out++ = s[j];
+            else             out += utf8_encode(s[j], out);
+        }
+        from += k;
+        n    -= k;
+    }
+    return out - start;
+}
+
+/*-----------------------------------------------  
+    chunked mode
+ -----------------------------------------------*/
+
+/* make room for n more pieces */
+static void chunks_reserve(readline *row, int n) {
+    row_chunks *c = row->chunks;
+    int count = c ? c->count : 0;
+    if (c != NULL && count + n <= c->capacity) return;
+    int old_capacity = c ? c->capacity : 0;
+    int capacity     = old_capacity < 8 ? 16 : old_capacity * 2;
+    if (capacity < count + n) capacity = count + n;
+    c = slab_resize(c, sizeof(row_chunks) + sizeof(row_chunk) * old_capacity,
+                       sizeof(row_chunks) + sizeof(row_chunk) * capacity);
+    if (row->chunks == NULL) {
+        c->count = 0;
+        c->valid = 0;
+    }
+    c->capacity = capacity;
+    row->chunks = c;
+}
+
+static void chunks_free(readline *row) {
+    row_chunks *c = row->chunks;
+    for (int k = 0; k < c->count; k++) free_row(&c->piece[k].row);
+    slab_free(c, sizeof(row_chunks) + sizeof(row_chunk) * c->capacity);
+    row->chunks = NULL;
+}
+
+/* The pieces from k on were edited, inserted or removed: recount their
+ * first characters and forget the columns. Positions are kept up to
+ * date right away so that reading a row never writes to it. */
+static void chunks_changed(readline *row, int k) {
+    row_chunks *c = row->chunks;
+    if (k < c->count)  c->piece[k].width = -1;
+    if (c->valid > k)  c->valid = k;
+    for (int j = k; j < c->count; j++)
+        c->piece[j].start = j == 0 ? 0
+                          : c->piece[j-1].start + c->piece[j-1].row.line_end;
+}
+
+/* insert a piece holding the n UTF-8 bytes of s in front of piece k */
+static void chunks_insert(readline *row, int k, const char *s, int n) {
+    chunks_reserve(row, 1);
+    row_chunks *c = row->chunks;
+    memmove(&c->piece[k+1], &c->piece[k], (c->count - k) * sizeof(row_chunk));
+    row_chunk *p = &c->piece[k];
+    make_new_row(&p->row);
+    row_load_utf8(&p->row, s, n);
+    p->width = -1;
+    c->count++;
+}
+
+static void chunks_remove(readline *row, int k) {
+    row_chunks *c = row->chunks;
+    free_row(&c->piece[k].row);
+    memmove(&c->piece[k], &c->piece[k+1], (c->count - k - 1) * sizeof(row_chunk));
+    c->count--;
+}
+
+/* Cuts the n UTF-8 bytes of s into pieces of ROW_CHUNK bytes, which
+ * are inserted in front of piece k. Returns the number of characters. */
+static int chunks_cut_utf8(readline *row, int k, const char *s, int n) {
+    const unsigned char *u = (const unsigned char *) s;
+    int chars = 0;
+    chunks_reserve(row, n / ROW_CHUNK + 1);
+    while (n > 0) {
+        int b = n < ROW_CHUNK ? n : ROW_CHUNK;
+        /* do not cut a character apart */
+        for (int j = 0; j < 3 && b < n && (u[b] & 0xC0) == 0x80; j++) b--;
+        chunks_insert(row, k, (const char *) u, b);
+        chars += row->chunks->piece[k++].row.line_end;
+        u += b;
+        n -= b;
+    }
+    return chars;
+}
+
+/* inserts the characters of src from from on as pieces in front of piece k */
+static void chunks_cut(readline *row, int k, readline *src, int from) {
+    char *bytes = malloc(4 * ROW_CHUNK);
+    chunks_reserve(row, (src->line_end - from) / ROW_CHUNK + 1);
+    for (; from < src->line_end; from += ROW_CHUNK) {
+        int n = src->line_end - from;
+        if (n > ROW_CHUNK) n = ROW_CHUNK;
+        chunks_insert(row, k++, bytes, row_encode(src, from, n, bytes));
+    }
+    free(bytes);
+}
+
+static void chunks_load(readline *row, const char *s, int n) {
+    row->line_end = chunks_cut_utf8(row, 0, s, n);
+    chunks_changed(row, 0);
+}
+
+/* turns a row that grows beyond ROW_LONG characters into pieces */
+static void chunks_make(readline *row) {
+    readline whole = *row;
+    make_new_row(row);
+    row->cursor   = whole.cursor;
+    row->margin   = whole.margin;
+    row->line_end = whole.line_end;
+    chunks_reserve(row, whole.line_end / ROW_CHUNK + 1);
+    chunks_cut(row, 0, &whole, 0);
+    chunks_changed(row, 0);
+    free_row(&whole);
+}
+
+/* turns a chunked row back into a gap buffer */
+static void chunks_join(readline *row) {
+    int length = slab_round(sizeof(wint_t) * (row->line_end + LINE_BLOCK_SIZE))
+                 / sizeof(wint_t);
+    wint_t *buffer = slab_alloc(sizeof(wint_t) * length);
+    row_copy_out(row, 0, row->line_end, buffer);
+    chunks_free(row);
+    row->buffer      = buffer;
+    row->line_length = length;
+    row->gap         = row->line_end;
+    row->tab_count   = -1;
+}
+
+/* number of the piece holding position i, the last one for the end of the line */
+static int chunks_find(readline *row, int i) {
+    row_chunks *c = row->chunks;
+    int low = 0, high = c->count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (c->piece[mid].start <= i) low  = mid;
+        else                          high = mid - 1;
+    }
+    return low;
+}
+
+/* display column behind piece p */
+static int chunk_end_column(row_chunk *p) {
+    if (p->width < 0) {
+        if (p->row.tab_count < 0) row_map_tabs(&p->row);
+        p->first_tab = p->row.tab_count > 0 ? p->row.tabs[0] : -1;
+        p->width     = row_column_from(&p->row, 0, p->row.line_end);
+    }
+    if (p->first_tab < 0) return p->column + p->width;
+    /* behind the first tab the piece is shifted by whole tab stops */
+    int f = p->first_tab;
+    return p->width + ((p->column + f)/TAB_STOP_WIDTH - f/TAB_STOP_WIDTH) * TAB_STOP_WIDTH;
+}
+
+/* brings the columns of the pieces up to date */
+static void chunks_columns(readline *row) {
+    row_chunks *c = row->chunks;
+    for (; c->valid < c->count; c->valid++)
+        c->piece[c->valid].column = c->valid == 0 ? 0
+                                  : chunk_end_column(&c->piece[c->valid - 1]);
+}
+
+/* number of the piece holding display column column */
+static int chunks_find_column(readline *row, int column) {
+    chunks_columns(row);
+    row_chunks *c = row->chunks;
+    int low = 0, high = c->count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (c->piece[mid].column <= column) low  = mid;
+        else                                high = mid - 1;
+    }
+    return low;
+}
+
+/* Inserts into the piece holding pos. Long texts go in ROW_CHUNK
+ * characters at a time and a piece that grew too long is cut again,
+ * so no piece ever comes near ROW_LONG. */
+static void chunks_insert_n(readline *row, int pos, const wint_t *s, int n) {
+    /* a row that was empty when it was chunked has no piece yet */
+    if (row->chunks->count == 0) {
+        chunks_insert(row, 0, NULL, 0);
+        chunks_changed(row, 0);
+    }
+    while (n > 0) {
+        int m = n < ROW_CHUNK ? n : ROW_CHUNK;
+        int k = chunks_find(row, pos);
+        readline *piece = &row->chunks->piece[k].row;
+        row_insert_n(piece, pos - row->chunks->piece[k].start, s, m);
+        if (piece->line_end > 2 * ROW_CHUNK) {
+            readline whole = *piece;
+            make_new_row(piece);
+            chunks_remove(row, k);
+            chunks_cut(row, k, &whole, 0);
+            free_row(&whole);
+        }
+        row->line_end += m;
+        chunks_changed(row, k);
+        pos += m;
+        s   += m;
+        n   -= m;
+    }
+}
+
+/* deletes n characters from pos on, pieces that run empty are dropped */
+static void chunks_delete(readline *row, int pos, int n) {
+    int first = chunks_find(row, pos);
+    int k     = first;
+    row->line_end -= n;
+    for (pos -= row->chunks->piece[k].start; n > 0; pos = 0) {
+        readline *piece = &row->chunks->piece[k].row;
+        int m = piece->line_end - pos;
+        if (m > n) m = n;
+        if (m == piece->line_end) {
+            chunks_remove(row, k);
+        } else {
+            row_delete(piece, pos, m);
+            row->chunks->piece[k++].width = -1;
+        }
+        n -= m;
+    }
+    chunks_changed(row, first);
+}
+
+static void chunks_append(readline *row, readline *src, int from) {
+    int k = row->chunks->count;
+    row->line_end += src->line_end - from;
+    chunks_cut(row, k, src, from);
+    chunks_changed(row, k);
+}
@@ -0,0 +1,152 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROW_GUARD
+#define ROW_GUARD
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "slab.h"
+
+#define LINE_BLOCK_SIZE  100
+#define ROW_INDEX_STRIDE  64
+#define ROW_LONG    (1<<20) /* lines longer than this are chunked */
+#define ROW_CHUNK   (16<<10)
+
+/* Has to correlate to the tab width of the terminal
+ * but this is not guaranteed if the user has set
+ * the terminal tab with by himself. Should read
+ * terminal tab width and set this value accordingly.
+ */
+#define TAB_STOP_WIDTH   8
+
+/* A readline is stored in one of three modes.
+ *
+ * Compact mode (buffer == NULL): the line is kept as the UTF-8 bytes
+ * read from the file. Plain ASCII lines map character i to byte i, all
+ * other lines carry a sparse index holding the byte offset of every
+ * ROW_INDEX_STRIDE-th character. The bytes are either a copy owned by
+ * the row or, for a row of a mapped file, read in place (shared).
+ *
+ * Wide mode (buffer != NULL): the line is a gap buffer of wint_t. The
+ * characters [0, gap) are stored at the front of buffer, the remaining
+ * line_end - gap characters at the very end of it. A compact line is
+ * converted to wide mode the first time it is edited.
+ *
+ * Chunked mode (chunks != NULL): lines longer than ROW_LONG characters
+ * are cut into pieces of about ROW_CHUNK characters, each of them a
+ * compact or wide readline of its own. The pieces know their first
+ * character and display column, so that a position or a column is
+ * found by binary search and an edit only ever thaws one piece.
+ *
+ * Tabs are stored as a single character in every mode. Display columns
+ * are derived from the positions of the tabs in the line, which are
+ * collected the first time a column is asked for and kept up to date
+ * by every edit afterwards.
+ *
+ * All access from the editor goes through the row_* functions below.
+ */
+typedef struct readline {
+    int     cursor;
+    int     line_end;     /* number of characters in the line */
+    int     line_length;  /* number of allocated cells */
+    int     margin;
+    int     gap;          /* start of the gap */
+    int     text_length;
+    int     tab_count;    /* -1 until the tab positions are collected */
+    int     shared;       /* compact mode: text belongs to a mapped file */
+    wint_t *buffer;
+    char   *text;         /* compact mode: UTF-8 bytes */
+    int    *index;        /* compact mode: NULL if character i is byte i */
+    int    *tabs;         /* positions of the tabs in the line */
+    struct row_chunks *chunks;
+} readline;
+
+/* one piece of a chunked row */
+typedef struct row_chunk {
+    readline row;
+    int      start;      /* position of the first character */
+    int      column;     /* display column of the first character */
+    int      first_tab;  /* position of the first tab in the piece, -1 if none */
+    int      width;      /* columns the piece takes from column 0, -1 if unknown */
+} row_chunk;
+
+typedef struct row_chunks {
+    int       count;
+    int       capacity;
+    int       valid;     /* start and column of the pieces [0, valid) are known */
+    row_chunk piece[];
+} row_chunks;
+
+void   make_new_row    (readline*);
+void   free_row        (readline*);
+void   row_load_utf8   (readline*, const char*, int);
+void   row_map_utf8    (readline*, const char*, int);
+void   row_thaw        (readline*);
+void   row_insert      (readline*, int, wint_t);
+void   row_insert_n    (readline*, int, const wint_t*, int);
+void   row_delete      (readline*, int, int);
+void   row_truncate    (readline*, int);
+void   row_append      (readline*, readline*, int);
+void   row_copy_out    (readline*, int, int, wint_t*);
+int    row_encode      (readline*, int, int, char*);
+int    row_column      (readline*, int);
+int    row_index       (readline*, int);
+int    row_seek        (readline*, int);
+int    row_seek_char   (readline*, int);
+wint_t row_get_compact (readline*, int);
+int    utf8_decode     (const unsigned char*, int, wint_t*);
+int    utf8_is_ascii   (const unsigned char*, int);
+int    utf8_encode     (wint_t, char*);
+
+/* TRUE if the row is kept as UTF-8 bytes in row->text */
+static inline int row_is_compact(readline *row) {
+    return row->buffer == NULL && row->chunks == NULL;
+}
+
+/* TRUE if character i of the row is byte i of row->text */
+static inline int row_is_ascii(readline *row) {
+    return row_is_compact(row) && row->index == NULL;
+}
+
+/* character at position i, 0 beyond the end of the line */
+static inline wint_t row_get(readline *row, int i) {
+    if (i < 0 || i >= row->line_end) return 0;
+    if (row->buffer == NULL) {
+        if (row_is_ascii(row)) return (unsigned char) row->text[i];
+        return row_get_compact(row, i);
+    }
+    if (i >= row->gap) i += row->line_length - row->line_end;
+    return row->buffer[i];
+}
+
+static inline void row_set(readline *row, int i, wint_t c) {
+    if (i < 0 || i >= row->line_end) return;
+    if (row->chunks != NULL) {
+        row_delete(row, i, 1);
+        row_insert(row, i, c);
+        return;
+    }
+    row_thaw(row);
+    if (i >= row->gap) i += row->line_length - row->line_end;
+    row->buffer[i] = c;
+}
+
+#endif /* ROW_GUARD */
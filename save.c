@@ -0,0 +1,273 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "save.h"
+
+/* mode of a new file, 0666 less the umask as with fopen */
+static mode_t create_mode = 0644;
+
+/* Reads the umask, which can only be had by setting it. Called once at
+ * startup, before any thread may create a file. */
+void save_init(void) {
+    mode_t mask = umask(0);
+    umask(mask);
+    create_mode = 0666 & ~mask;
+}
+
+static void save_flush(save_job *job) {
+    size_t done = 0;
+    while (done < job->used && !job->error) {
+        ssize_t n = write(job->fd, &job->data[done], job->used - done);
+        if (n < 0 && errno != EINTR) job->error = errno;
+        if (n > 0) done += n;
+    }
+    job->bytes += done;
+    job->used   = 0;
+}
+
+/*-----------------------------------------------  
+    copies of changed rows
+ -----------------------------------------------*/
+
+static long slot_of(save_job *job, readline *row) {
+    uintptr_t h = (uintptr_t) row >> 4;
+    long slot = (h * 0x9E3779B97F4A7C15u) & (job->capacity - 1);
+    while (job->keys[slot] != NULL && job->keys[slot] != row)
+        slot = (slot + 1) & (job->capacity - 1);
+    return slot;
+}
+
+/* the text of row as of the snapshot */
+static readline *snapshot_row(save_job *job, readline *row) {
+    if (job->kept == 0) return row;
+    long slot = slot_of(job, row);
+    return job->keys[slot] != NULL ? job->copies[slot] : row;
+}
+
+/* remembers copy as the text of row, FALSE if row has one already */
+static int put_copy(save_job *job, readline *row, readline *copy) {
+    if (2 * (job->kept + 1) > job->capacity) {
+        readline **keys   = job->keys;
+        readline **copies = job->copies;
+        long capacity = job->capacity;
+        job->capacity = capacity ? 2 * capacity : 64;
+        job->keys     = calloc(job->capacity, sizeof(readline *));
+        job->copies   = malloc(job->capacity * sizeof(readline *));
+        for (long i = 0; i < capacity; i++) {
+            if (keys[i] == NULL) continue;
+            long slot = slot_of(job, keys[i]);
+            job->keys  [slot] = keys[i];
+            job->copies[slot] = copies[i];
+        }
+        free(keys);
+        free(copies);
+    }
+    long slot = slot_of(job, row);
+    if (job->keys[slot] != NULL) return 0;
+    job->keys  [slot] = row;
+    job->copies[slot] = copy;
+    job->kept++;
+    return 1;
+}
+
+/* Row is about to change: keeps a copy of its text for the writer,
+ * unless it has one already. Rows made after the snapshot are copied
+ * as well, that is cheaper than finding out. */
+void save_keep(save_job *job, readline *row) {
+    if (!job->saving || row == NULL) return;
+    if (job->kept > 0 && job->keys[slot_of(job, row)] != NULL) return;
+    readline *copy = slab_alloc(sizeof(readline));
+    make_new_row(copy);
+    row_append(copy, row, 0);
+    put_copy(job, row, copy);
+}
+
+/* Row is removed from the document. Returns TRUE if the save takes it
+ * over and frees it when it is done. */
+int save_take(save_job *job, readline *row) {
+    if (!job->saving) return 0;
+    return put_copy(job, row, row);
+}
+
+/*-----------------------------------------------  
+    writing
+ -----------------------------------------------*/
+
+static void add_piece(save_job *job, const void *data, long length) {
+    if (job->count % 4096 == 0)
+        job->pieces = realloc(job->pieces, (job->count + 4096) * sizeof(save_piece));
+    job->pieces[job->count].data   = data;
+    job->pieces[job->count].length = length;
+    job->count++;
+}
+
+/* lists the first count rows of the document */
+static void snapshot(save_job *job, line_node *rows, int count) {
+    line_iter iter;
+    lines_iter_start(rows, 0, &iter);
+    int i = 0;
+    for (line_node *leaf = iter.leaf; leaf != NULL && i < count; leaf = leaf->next) {
+        /* leaves of a mapped file that were never paged in are copied
+         * from the mapping. Their lines end in newlines, except for the
+         * last line of the file, which is in the last leaf. */
+        if (leaf->source != NULL) {
+            long n = leaf->source_length;
+            i += leaf->count;
+            if (leaf->next != NULL && i == count) n--;
+            add_piece(job, leaf->source, n);
+            continue;
+        }
+        for (int k = 0; k < leaf->count && i < count; k++, i++)
+            add_piece(job, leaf->entry.row[k], -1);
+    }
+}
+
+/* Encodes pieces into the buffer until it is full. A row longer than
+ * the buffer is continued where it stopped. Returns TRUE once every
+ * piece is in. */
+static int encode(save_job *job) {
+    for (; job->next < job->count; job->next++, job->from = 0) {
+        save_piece *piece = &job->pieces[job->next];
+        if (piece->length >= 0) {
+            long n = piece->length - job->from;
+            if (n > SAVE_BLOCK_SIZE - job->used) n = SAVE_BLOCK_SIZE - job->used;
+            memcpy(&job->data[job->used], (const char *) piece->data + job->from, n);
+            job->used += n;
+            job->from += n;
+            if (job->from < piece->length) return 0;
+            continue;
+        }
+        readline *row = snapshot_row(job, (readline *) piece->data);
+        while (job->from < row->line_end) {
+            long n = (SAVE_BLOCK_SIZE - job->used) / 4;
+            if (n == 0) return 0;
+            if (n > row->line_end - job->from) n = row->line_end - job->from;
+            job->used += row_encode(row, job->from, n, &job->data[job->used]);
+            job->from += n;
+        }
+        /* rows are separated, not terminated, by newlines */
+        if (job->next < job->count - 1) {
+            if (job->used == SAVE_BLOCK_SIZE) return 0;
+            job->data[job->used++] = '\n';
+        }
+    }
+    return 1;
+}
+
+/* The document goes to a temporary file next to the original which is
+ * renamed over it once it is complete, so a failed save never leaves
+ * a truncated file. */
+static void *writer(void *arg) {
+    save_job *job = arg;
+    /* replace the target of a symbolic link, not the link */
+    char *target = realpath(job->filename, NULL);
+    if (target == NULL) target = strdup(job->filename);
+    char *temp = malloc(strlen(target) + 8);
+    sprintf(temp, "%s.XXXXXX", target);
+    job->fd = mkstemp(temp);
+    if (job->fd == -1) {
+        job->error = errno;
+    } else {
+        /* mkstemp creates the file 0600 */
+        struct stat st;
+        fchmod(job->fd, stat(target, &st) == 0 ? st.st_mode & 07777 : create_mode);
+        int complete = 0;
+        while (!complete && !job->error) {
+            if (job->lock) pthread_mutex_lock(job->lock);
+            complete = encode(job);
+            if (job->lock) pthread_mutex_unlock(job->lock);
+            save_flush(job);
+        }
+        if (job->sync && !job->error && fsync(job->fd) == -1) job->error = errno;
+        if (close(job->fd) == -1 && !job->error) job->error = errno;
+        if (!job->error && rename(temp, target) == -1) job->error = errno;
+        if (job->error) unlink(temp);
+    }
+    free(temp);
+    free(target);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (job->lock) pthread_mutex_lock(job->lock);
+    job->done    = 1;
+    job->seconds = (end.tv_sec - job->start.tv_sec) + (end.tv_nsec - job->start.tv_nsec) / 1e9;
+    if (job->lock) pthread_mutex_unlock(job->lock);
+    return NULL;
+}
+
+/* Snapshots the first count rows and starts writing them to filename,
+ * fsync'ed if sync is set. With a lock the file is written in the
+ * background while the caller holds it, otherwise right away. */
+void save_start(save_job *job, line_node *rows, int count, const char *filename,
+                int sync, pthread_mutex_t *lock) {
+    memset(job, 0, sizeof(save_job));
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job->saving   = 1;
+    job->sync     = sync;
+    job->lock     = lock;
+    job->filename = strdup(filename);
+    job->data     = malloc(SAVE_BLOCK_SIZE);
+    snapshot(job, rows, count);
+    if (lock != NULL)
+        job->running = pthread_create(&job->thread, NULL, writer, job) == 0;
+    if (job->running) return;
+    job->lock = NULL;
+    writer(job);
+}
+
+/* TRUE once when the save is complete, the copies of the rows are
+ * freed. The caller holds the lock. */
+int save_finish(save_job *job) {
+    if (!job->saving || !job->done) return 0;
+    if (job->running) {
+        pthread_join(job->thread, NULL);
+        job->running = 0;
+    }
+    for (long i = 0; i < job->capacity; i++) {
+        if (job->keys[i] == NULL) continue;
+        free_row(job->copies[i]);
+        slab_free(job->copies[i], sizeof(readline));
+    }
+    free(job->keys);
+    free(job->copies);
+    free(job->pieces);
+    free(job->data);
+    free(job->filename);
+    job->keys     = job->copies = NULL;
+    job->pieces   = NULL;
+    job->data     = NULL;
+    job->filename = NULL;
+    job->saving   = 0;
+    return 1;
+}
+
+/* Waits until the file is written. The caller holds the lock, which is
+ * released while waiting for the writer. */
+void save_wait(save_job *job) {
+    if (!job->running) return;
+    pthread_mutex_unlock(job->lock);
+    pthread_join(job->thread, NULL);
+    pthread_mutex_lock(job->lock);
+    job->running = 0;
+}
@@ -0,0 +1,82 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SAVE_GUARD
+#define SAVE_GUARD
+
+#include <pthread.h>
+#include <time.h>
+#include "lines.h"
+
+/* Size of the output buffer. The document is encoded into it and
+ * written with one write(2) whenever it fills up. */
+#define SAVE_BLOCK_SIZE (1 << 20)
+
+/* Flush the temporary file to disk before it replaces the original. */
+#define SAVE_FSYNC 1
+
+/* one entry of a snapshot: a row, or the lines of a leaf of a mapped
+ * file that was never paged in */
+typedef struct save_piece {
+    const void *data;
+    long        length;     /* bytes of the lines, -1 for a row */
+} save_piece;
+
+/* A save in the background. The document is snapshot as the list of
+ * its rows, which takes a pointer per row and copies no text. A writer
+ * thread encodes the rows into the buffer while it holds the lock of
+ * the document and writes the buffer out without it, so a slow disk
+ * never holds up the editor.
+ *
+ * The rows are shared with the document and copied on write: before
+ * the editor changes a row while a save is under way it hands the row
+ * to save_keep, which keeps a copy of its text for the writer. A row
+ * removed from the document goes to save_take and lives on until the
+ * save is done. */
+typedef struct save_job {
+    char             saving;        /* started and not finished yet */
+    char             running;       /* writer thread started */
+    char             done;          /* the file is written or failed */
+    char             sync;
+    int              error;
+    pthread_t        thread;
+    pthread_mutex_t *lock;          /* lock of the document, NULL if none */
+    char            *filename;
+    save_piece      *pieces;
+    long             count;
+    long             next;          /* first piece not completely encoded */
+    long             from;          /* characters or bytes of it encoded */
+    readline       **keys;          /* rows changed since the snapshot */
+    readline       **copies;        /* their text as of the snapshot */
+    long             capacity;
+    long             kept;
+    char            *data;
+    size_t           used;
+    int              fd;
+    size_t           bytes;         /* bytes written */
+    struct timespec  start;
+    double           seconds;
+} save_job;
+
+void save_init   (void);
+void save_start  (save_job*, line_node*, int, const char*, int, pthread_mutex_t*);
+void save_keep   (save_job*, readline*);
+int  save_take   (save_job*, readline*);
+int  save_finish (save_job*);
+void save_wait   (save_job*);
+
+#endif
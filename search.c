@@ -0,0 +1,291 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <wctype.h>
+#include "search.h"
+
+/* patterns up to this many bytes are not searched with skip tables */
+#define SEARCH_SHORT 4
+
+/* rows that are not compact are decoded this many characters at a time */
+#define SEARCH_BLOCK (64 << 10)
+
+#define FOLD(p, c) ((p)->fold ? (wint_t) towlower(c) : (c))
+
+/* Compiles the length characters of s, folded to lower case if fold
+ * is set. Returns FALSE for an empty pattern. */
+int search_compile(search_pattern *p, const wint_t *s, int length, int fold) {
+    memset(p, 0, sizeof(search_pattern));
+    p->guard = -1;
+    if (length <= 0) return 0;
+    p->fold   = fold;
+    p->length = length;
+    p->chars  = malloc(sizeof(wint_t) * length);
+    for (int i = 0; i < length; i++) {
+        p->chars[i] = FOLD(p, s[i]);
+        if (p->chars[i] == 0xA) p->lines++;
+    }
+    for (int c = 0; c < 256; c++) p->char_skip[c] = length;
+    for (int i = 0; i < length - 1; i++)
+        p->char_skip[p->chars[i] & 0xFF] = length - 1 - i;
+    if (p->lines) return 1;
+
+    /* the byte search is exact only if no character outside ASCII
+     * has another case form */
+    for (int i = 0; i < length; i++) {
+        wint_t c = p->chars[i];
+        if (fold && c >= 0x80 && towupper(c) != c) return 1;
+    }
+    p->bytes = malloc(4 * length);
+    for (int i = 0; i < length; i++)
+        p->byte_length += utf8_encode(p->chars[i], (char *) &p->bytes[p->byte_length]);
+    int m = p->byte_length;
+    for (int b = 0; b < 256; b++) {
+        p->byte_fold[b] = (fold && b >= 'A' && b <= 'Z') ? b + 32 : b;
+        p->byte_skip[b] = m;
+    }
+    for (int i = 0; i < m - 1; i++)
+        p->byte_skip[p->bytes[i]] = m - 1 - i;
+    /* prefer bytes that are rare in text: not spaces, not lower case */
+    int rank = 1;
+    for (int i = 0; i < m; i++) {
+        unsigned char b = p->bytes[i];
+        int r = b >= 0x80 ? 4 : b == ' ' ? 0 : (b >= 'a' && b <= 'z') ? 1 : 3;
+        if (fold && ((b | 0x20) >= 'a' && (b | 0x20) <= 'z')) r = 0;
+        if (r > rank) {
+            rank     = r;
+            p->guard = i;
+        }
+    }
+    return 1;
+}
+
+void search_free(search_pattern *p) {
+    free(p->chars);
+    free(p->bytes);
+    p->chars = NULL;
+    p->bytes = NULL;
+}
+
+static int bytes_equal(search_pattern *p, const unsigned char *s) {
+    for (int k = 0; k < p->byte_length; k++)
+        if (p->byte_fold[s[k]] != p->bytes[k]) return 0;
+    return 1;
+}
+
+/* Position of the first byte of s[0, n) that is a or b, n if none.
+ * Tests eight bytes at a time. */
+static int scan_pair(const unsigned char *s, int n, unsigned char a, unsigned char b) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t high = 0x8080808080808080ULL;
+    uint64_t pa = ones * a;
+    uint64_t pb = ones * b;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, &s[i], 8);
+        uint64_t x = word ^ pa;
+        uint64_t y = word ^ pb;
+        if (((x - ones) & ~x & high) | ((y - ones) & ~y & high)) break;
+    }
+    for (; i < n; i++)
+        if (s[i] == a || s[i] == b) return i;
+    return n;
+}
+
+/* first match in the bytes [from, n) of s, -1 if none */
+static int search_bytes(search_pattern *p, const unsigned char *s, int n, int from) {
+    int m = p->byte_length;
+    if (n - from < m) return -1;
+    if (p->guard >= 0) {
+        int g = p->guard;
+        const unsigned char *at  = &s[from + g];
+        const unsigned char *end = &s[n - m + g + 1];
+        while (at < end && (at = memchr(at, p->bytes[g], end - at)) != NULL) {
+            if (bytes_equal(p, at - g)) return at - g - s;
+            at++;
+        }
+        return -1;
+    }
+    int last = m - 1;
+    if (m <= SEARCH_SHORT) {
+        /* skips are too short to pay off, scan for both cases instead */
+        unsigned char b = p->bytes[last];
+        unsigned char u = p->fold ? b - 32 : b;
+        for (int i = from; i <= n - m; i++) {
+            i += scan_pair(&s[i + last], n - m - i + 1, b, u);
+            if (i <= n - m && bytes_equal(p, &s[i])) return i;
+        }
+        return -1;
+    }
+    for (int i = from; i <= n - m; ) {
+        unsigned char b = p->byte_fold[s[i + last]];
+        if (b == p->bytes[last] && bytes_equal(p, &s[i])) return i;
+        i += p->byte_skip[b];
+    }
+    return -1;
+}
+
+static int chars_equal(search_pattern *p, const wint_t *s, int n) {
+    for (int k = 0; k < n; k++)
+        if (FOLD(p, s[k]) != p->chars[k]) return 0;
+    return 1;
+}
+
+/* first match in the characters [from, n) of s, -1 if none */
+static int search_chars(search_pattern *p, const wint_t *s, int n, int from) {
+    int m    = p->length;
+    int last = m - 1;
+    for (int i = from; i <= n - m; ) {
+        wint_t c = FOLD(p, s[i + last]);
+        if (c == p->chars[last] && chars_equal(p, &s[i], last)) return i;
+        i += p->char_skip[c & 0xFF];
+    }
+    return -1;
+}
+
+/* TRUE if the characters [at, at + n) of row equal chars */
+static int row_equal(search_pattern *p, readline *row, int at, const wint_t *chars, int n) {
+    if (at < 0 || at + n > row->line_end) return 0;
+    for (int k = 0; k < n; k++)
+        if (FOLD(p, row_get(row, at + k)) != chars[k]) return 0;
+    return 1;
+}
+
+/* First match of a pattern without newlines in row, starting at or
+ * after character from. Returns the character index or -1. */
+int search_row(search_pattern *p, readline *row, int from) {
+    if (from < 0) from = 0;
+    if (row->line_end - from < p->length) return -1;
+    if (row_is_compact(row) && p->bytes != NULL) {
+        int b = search_bytes(p, (const unsigned char *) row->text,
+                             row->text_length, row_seek(row, from));
+        return b < 0 ? -1 : row_seek_char(row, b);
+    }
+    /* consecutive blocks overlap by the length of the pattern less one,
+     * so a match crossing a block boundary is found in the first one */
+    int block = row->line_end - from;
+    if (block > SEARCH_BLOCK) block = SEARCH_BLOCK;
+    wint_t *chars = malloc(sizeof(wint_t) * (block + p->length));
+    int found = -1;
+    for (int at = from; found < 0 && at + p->length <= row->line_end; at += block) {
+        int n = row->line_end - at;
+        if (n > block + p->length - 1) n = block + p->length - 1;
+        row_copy_out(row, at, n, chars);
+        int i = search_chars(p, chars, n, 0);
+        if (i >= 0) found = at + i;
+    }
+    free(chars);
+    return found;
+}
+
+/* Match of a pattern with newlines starting in row r: the first line of
+ * the pattern ends the row, the inner lines are whole rows and the last
+ * line starts row r + lines. */
+static int search_lines(search_pattern *p, line_node *rows, int count,
+                        int r, readline *row, int from) {
+    const wint_t *line = p->chars;
+    int n = 0;
+    while (line[n] != 0xA) n++;
+    int at = row->line_end - n;
+    if (at < from || !row_equal(p, row, at, line, n)) return -1;
+    for (int k = 1; k <= p->lines; k++) {
+        if (r + k >= count) return -1;
+        line += n + 1;
+        for (n = 0; &line[n] < &p->chars[p->length] && line[n] != 0xA; n++);
+        readline *next = lines_get(rows, r + k);
+        if (k < p->lines && next->line_end != n) return -1;
+        if (!row_equal(p, next, 0, line, n)) return -1;
+    }
+    return at;
+}
+
+/* Finds the first match at or after character from of row, looking no
+ * further than row end - 1, and fills in match. Returns FALSE if there
+ * is none. */
+int search_span(search_pattern *p, line_node *rows, int count,
+                int row, int end, int from, search_match *match) {
+    if (p->length == 0 || row >= end) return 0;
+    line_iter iter;
+    readline *row_pointer = lines_iter_start(rows, row, &iter);
+    for (int r = row; r < end; r++, row_pointer = lines_iter_next(&iter)) {
+        int i = p->lines ? search_lines(p, rows, count, r, row_pointer, from)
+                         : search_row(p, row_pointer, from);
+        if (i >= 0) {
+            match->row    = r;
+            match->cursor = i;
+            return 1;
+        }
+        from = 0;
+    }
+    return 0;
+}
+
+/* Counts the matches that start in rows [row, end), from character
+ * from of the first one. Matches do not overlap. */
+long search_count(search_pattern *p, line_node *rows, int count,
+                  int row, int end, int from) {
+    if (p->length == 0 || row >= end) return 0;
+    long total = 0;
+    line_iter iter;
+    readline *row_pointer = lines_iter_start(rows, row, &iter);
+    for (int r = row; r < end; r++, row_pointer = lines_iter_next(&iter)) {
+        if (p->lines) {
+            /* a row ends with the first line of at most one match */
+            total += search_lines(p, rows, count, r, row_pointer, from) >= 0;
+        } else {
+            for (int i = search_row(p, row_pointer, from); i >= 0;
+                     i = search_row(p, row_pointer, i + p->length))
+                total++;
+        }
+        from = 0;
+    }
+    return total;
+}
+
+/* Finds the last match starting before character before of row.
+ * Returns FALSE if there is none. */
+int search_backward(search_pattern *p, line_node *rows, int count,
+                    int row, int before, search_match *match) {
+    if (p->length == 0) return 0;
+    if (row >= count) {
+        row    = count - 1;
+        before = INT_MAX;
+    }
+    for (int r = row; r >= 0; r--, before = INT_MAX) {
+        readline *row_pointer = lines_get(rows, r);
+        int last = -1;
+        if (p->lines) {
+            last = search_lines(p, rows, count, r, row_pointer, 0);
+            if (last >= before) last = -1;
+        } else {
+            for (int i = search_row(p, row_pointer, 0); i >= 0 && i < before;
+                     i = search_row(p, row_pointer, i + 1))
+                last = i;
+        }
+        if (last >= 0) {
+            match->row    = r;
+            match->cursor = last;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEARCH_GUARD
+#define SEARCH_GUARD
+
+#include "lines.h"
+
+/* A compiled literal pattern. The document is searched as if its rows
+ * were joined by newlines, so a pattern containing newlines matches
+ * across rows.
+ *
+ * Rows still in compact mode are searched in their UTF-8 bytes when
+ * folding the pattern needs ASCII case folding only. The scan uses
+ * memchr on a byte that has no other case form, or a Horspool skip
+ * table if every byte of the pattern is a letter. Other rows and
+ * patterns are matched character by character with a skip table over
+ * the low byte of the folded characters. */
+typedef struct search_pattern {
+    wint_t        *chars;         /* folded pattern */
+    int            length;
+    int            fold;          /* ignore case */
+    int            lines;         /* number of newlines in the pattern */
+    unsigned char *bytes;         /* UTF-8 form, NULL if unusable */
+    int            byte_length;
+    int            guard;         /* byte found by memchr, -1 for none */
+    unsigned char  byte_fold[256];
+    int            byte_skip[256];
+    int            char_skip[256];
+} search_pattern;
+
+typedef struct search_match {
+    int row;
+    int cursor;                   /* first character of the match */
+} search_match;
+
+int  search_compile (search_pattern*, const wint_t*, int, int);
+void search_free    (search_pattern*);
+int  search_row     (search_pattern*, readline*, int);
+int  search_span    (search_pattern*, line_node*, int, int, int, int, search_match*);
+int  search_backward(search_pattern*, line_node*, int, int, int, search_match*);
+long search_count   (search_pattern*, line_node*, int, int, int, int);
+
+#endif /* SEARCH_GUARD */
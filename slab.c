@@ -0,0 +1,224 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+
+/* 8 byte steps for small blocks, then four classes per doubling */
+static const int class_size[] = {
+       8,   16,   24,   32,   40,   48,   56,   64,
+      72,   80,   88,   96,  104,  112,  120,  128,
+     160,  192,  224,  256,  320,  384,  448,  512,
+     640,  768,  896, 1024, 1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096
+};
+#define CLASSES ((int) (sizeof(class_size) / sizeof(class_size[0])))
+
+typedef struct slab_page {
+    struct slab_page *next;   /* pages of the class with free slots */
+    struct slab_page *prev;
+    void *free;               /* freed slots, linked through their first word */
+    char *fresh;              /* slots never handed out start here */
+    int   class;
+    int   used;               /* slots handed out */
+    int   slots;
+    char  partial;            /* in the list of its class */
+} slab_page;
+
+/* the header rounded up to 16 bytes, slots of at least 8 bytes follow it */
+#define PAGE_HEADER ((sizeof(slab_page) + 15) & ~(size_t) 15)
+
+typedef struct text_block {
+    long used;                /* bytes packed so far */
+    long live;                /* bytes of rows still using them */
+} text_block;
+
+#define TEXT_HEADER ((sizeof(text_block) + 15) & ~(size_t) 15)
+
+static unsigned char class_of[SLAB_MAX / 8 + 1];
+static char          class_ready;
+static slab_page    *partial[CLASSES];
+static text_block   *text_current;
+static slab_stats    stats;
+
+static int size_class(size_t n) {
+    if (!class_ready) {
+        int c = 0;
+        for (int k = 1; k <= SLAB_MAX / 8; k++) {
+            while (class_size[c] < k * 8) c++;
+            class_of[k] = c;
+        }
+        class_ready = 1;
+    }
+    return class_of[(n + 7) / 8];
+}
+
+/* the size of the class a block of n bytes is cut from */
+size_t slab_round(size_t n) {
+    if (n == 0 || n > SLAB_MAX) return n;
+    return class_size[size_class(n)];
+}
+
+static void unlink_page(slab_page *page) {
+    if (page->prev) page->prev->next     = page->next;
+    else            partial[page->class] = page->next;
+    if (page->next) page->next->prev     = page->prev;
+    page->partial = 0;
+}
+
+static void link_page(slab_page *page) {
+    page->prev = NULL;
+    page->next = partial[page->class];
+    if (page->next) page->next->prev = page;
+    partial[page->class] = page;
+    page->partial = 1;
+}
+
+static slab_page *new_page(int c) {
+    void *memory;
+    if (posix_memalign(&memory, SLAB_PAGE_SIZE, SLAB_PAGE_SIZE) != 0) return NULL;
+    slab_page *page = memory;
+    page->free  = NULL;
+    page->fresh = (char *) page + PAGE_HEADER;
+    page->class = c;
+    page->used  = 0;
+    page->slots = (SLAB_PAGE_SIZE - PAGE_HEADER) / class_size[c];
+    link_page(page);
+    stats.pages++;
+    stats.reserved += SLAB_PAGE_SIZE;
+    return page;
+}
+
+void *slab_alloc(size_t n) {
+    if (n == 0) return NULL;
+    if (n > SLAB_MAX) {
+        stats.used     += n;
+        stats.reserved += n;
+        return malloc(n);
+    }
+    int c = size_class(n);
+    slab_page *page = partial[c];
+    if (page == NULL && (page = new_page(c)) == NULL) return NULL;
+    void *slot;
+    if (page->free != NULL) {
+        slot = page->free;
+        page->free = *(void **) slot;
+    } else {
+        slot = page->fresh;
+        page->fresh += class_size[c];
+    }
+    if (++page->used == page->slots) unlink_page(page);
+    stats.used  += class_size[c];
+    stats.slack += class_size[c] - n;
+    return slot;
+}
+
+void slab_free(void *p, size_t n) {
+    if (p == NULL || n == 0) return;
+    if (n > SLAB_MAX) {
+        stats.used     -= n;
+        stats.reserved -= n;
+        free(p);
+        return;
+    }
+    slab_page *page = (slab_page *) ((uintptr_t) p & ~(uintptr_t) (SLAB_PAGE_SIZE - 1));
+    int c = page->class;
+    stats.used  -= class_size[c];
+    stats.slack -= class_size[c] - n;
+    *(void **) p = page->free;
+    page->free = p;
+    page->used--;
+    if (!page->partial) link_page(page);
+    /* an empty page goes back unless it is the only one with room */
+    if (page->used == 0 && (page->prev != NULL || page->next != NULL)) {
+        unlink_page(page);
+        stats.pages--;
+        stats.reserved -= SLAB_PAGE_SIZE;
+        free(page);
+    }
+}
+
+/* the block p of old bytes now holds n bytes, the contents are kept */
+void *slab_resize(void *p, size_t old, size_t n) {
+    if (p == NULL) return slab_alloc(n);
+    if (old > SLAB_MAX && n > SLAB_MAX) {
+        stats.used     += (long) n - (long) old;
+        stats.reserved += (long) n - (long) old;
+        return realloc(p, n);
+    }
+    if (old <= SLAB_MAX && n <= SLAB_MAX && size_class(old) == size_class(n)) {
+        stats.slack += (long) old - (long) n;
+        return p;
+    }
+    void *q = slab_alloc(n);
+    memcpy(q, p, old < n ? old : n);
+    slab_free(p, old);
+    return q;
+}
+
+char *slab_text_alloc(size_t n) {
+    if (n == 0) return NULL;
+    if (n > SLAB_TEXT_MAX) {
+        stats.used     += n;
+        stats.reserved += n;
+        return malloc(n);
+    }
+    text_block *b = text_current;
+    if (b == NULL || b->used + n > SLAB_TEXT_BLOCK) {
+        void *memory;
+        if (posix_memalign(&memory, SLAB_TEXT_BLOCK, SLAB_TEXT_BLOCK) != 0)
+            return NULL;
+        if (b != NULL && b->live == 0) {
+            stats.text_blocks--;
+            stats.reserved -= SLAB_TEXT_BLOCK;
+            free(b);
+        }
+        b = text_current = memory;
+        b->used = TEXT_HEADER;
+        b->live = 0;
+        stats.text_blocks++;
+        stats.reserved += SLAB_TEXT_BLOCK;
+    }
+    char *text = (char *) b + b->used;
+    b->used    += n;
+    b->live    += n;
+    stats.used += n;
+    return text;
+}
+
+void slab_text_free(char *text, size_t n) {
+    if (text == NULL || n == 0) return;
+    stats.used -= n;
+    if (n > SLAB_TEXT_MAX) {
+        stats.reserved -= n;
+        free(text);
+        return;
+    }
+    text_block *b = (text_block *) ((uintptr_t) text & ~(uintptr_t) (SLAB_TEXT_BLOCK - 1));
+    b->live -= n;
+    if (b->live == 0 && b != text_current) {
+        stats.text_blocks--;
+        stats.reserved -= SLAB_TEXT_BLOCK;
+        free(b);
+    }
+}
+
+slab_stats slab_get_stats(void) {
+    return stats;
+}
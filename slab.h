@@ -0,0 +1,55 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLAB_GUARD
+#define SLAB_GUARD
+
+#include <stddef.h>
+
+/* Blocks up to SLAB_MAX bytes are cut from pages of one size class,
+ * larger ones come from malloc. Pages are aligned to their size, so a
+ * block finds its page by masking its address. */
+#define SLAB_PAGE_SIZE (64 << 10)
+#define SLAB_MAX       4096
+
+/* The UTF-8 text of the rows read from a file never changes, it is
+ * packed into blocks of SLAB_TEXT_BLOCK bytes. A block goes back to
+ * malloc once none of its rows uses it. Longer text comes from malloc. */
+#define SLAB_TEXT_BLOCK (1 << 20)
+#define SLAB_TEXT_MAX   (64 << 10)
+
+/* The storage of the rows: their structs, gap buffers, character
+ * indexes and file text. Callers pass the size of a block when it is
+ * freed or resized, blocks carry no header. All rows are allocated by
+ * the editor thread. */
+typedef struct slab_stats {
+    long used;       /* bytes of the blocks handed out */
+    long slack;      /* bytes of them lost to rounding up to a class */
+    long reserved;   /* bytes taken from malloc */
+    long pages;      /* pages of the size classes */
+    long text_blocks;
+} slab_stats;
+
+void      *slab_alloc      (size_t);
+void      *slab_resize     (void*, size_t, size_t);
+void       slab_free       (void*, size_t);
+size_t     slab_round      (size_t);
+char      *slab_text_alloc (size_t);
+void       slab_text_free  (char*, size_t);
+slab_stats slab_get_stats  (void);
+
+#endif /* SLAB_GUARD */
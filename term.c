@@ -0,0 +1,155 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include "row.h"
+#include "term.h"
+
+/*-----------------------------------------------  
+    terminal settings and geometry
+ -----------------------------------------------*/
+
+static struct termios saved_settings;
+static struct winsize size;
+/* set by the SIGWINCH handler, the size is read again on next use */
+static volatile sig_atomic_t size_changed = 1;
+
+void term_raw_mode(void) {
+    struct termios raw;
+    tcgetattr(STDIN_FILENO, &saved_settings);
+    raw = saved_settings;
+    /*  ICANON    input is not buffered
+     *  ECHO      don't write input to screen
+     *  ISIG      ignore control signals
+     *  VMIN      number of characters to read
+     *  VTIME     wait indefinitely
+     */
+    raw.c_iflag &= ~(ISTRIP | INLCR | IXON | IXANY | IXOFF);
+    raw.c_lflag &= ~(ISIG | ICANON | ECHO | ECHOE | ECHOK | ECHONL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+void term_restore(void) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_settings);
+}
+
+/* only sets a flag, safe to call from a signal handler */
+void term_resized(void) {
+    size_changed = 1;
+}
+
+static void term_read_size(void) {
+    size_changed = 0;
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
+}
+
+int term_width(void) {
+    if (size_changed) term_read_size();
+    return size.ws_col;
+}
+
+int term_height(void) {
+    if (size_changed) term_read_size();
+    return size.ws_row;
+}
+
+/*-----------------------------------------------  
+    frame buffer
+ -----------------------------------------------*/
+
+/* Everything drawn while handling one keystroke is collected here and
+ * sent to the terminal with a single write(2) by term_flush. */
+static char      *frame;
+static size_t     frame_used;
+static size_t     frame_size;
+static term_frame last_frame;
+static FILE      *frame_log;
+static int        frame_log_checked;
+
+static void term_reserve(size_t n) {
+    if (frame_used + n <= frame_size) return;
+    if (frame_size == 0) frame_size = TERM_FRAME_SIZE;
+    while (frame_used + n > frame_size) frame_size *= 2;
+    frame = realloc(frame, frame_size);
+}
+
+void term_write(const char *s, int n) {
+    term_reserve(n);
+    memcpy(&frame[frame_used], s, n);
+    frame_used += n;
+}
+
+void term_puts(const char *s) {
+    term_write(s, strlen(s));
+}
+
+void term_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (n < 0) return;
+    term_reserve(n + 1);
+    va_start(args, format);
+    vsnprintf(&frame[frame_used], n + 1, format, args);
+    va_end(args);
+    frame_used += n;
+}
+
+void term_putwc(wint_t c) {
+    term_reserve(4);
+    if (c < 0x80) frame[frame_used++] = c;
+    else          frame_used += utf8_encode(c, &frame[frame_used]);
+}
+
+void term_flush(void) {
+    if (frame_used == 0) return;
+    last_frame.bytes  = frame_used;
+    last_frame.writes = 0;
+    size_t done = 0;
+    while (done < frame_used) {
+        ssize_t n = write(STDOUT_FILENO, &frame[done], frame_used - done);
+        last_frame.writes++;
+        if (n < 0 && errno != EINTR) break;
+        if (n > 0) done += n;
+    }
+    frame_used = 0;
+
+    if (!frame_log_checked) {
+        char *name = getenv("MX_FRAME_LOG");
+        if (name != NULL) frame_log = fopen(name, "a");
+        frame_log_checked = 1;
+    }
+    if (frame_log != NULL) {
+        fprintf(frame_log, "%ld %d\n", last_frame.bytes, last_frame.writes);
+        fflush(frame_log);
+    }
+}
+
+term_frame term_stats(void) {
+    return last_frame;
+}
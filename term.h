@@ -0,0 +1,46 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TERM_GUARD
+#define TERM_GUARD
+
+#include <wchar.h>
+
+/* Initial size of the frame buffer, it grows when a frame needs more. */
+#define TERM_FRAME_SIZE (64 << 10)
+
+/* Output of the last flushed frame. If the environment variable
+ * MX_FRAME_LOG names a file, one "bytes writes" line is appended to it
+ * per frame. */
+typedef struct term_frame {
+    long bytes;
+    int  writes;
+} term_frame;
+
+void       term_raw_mode(void);
+void       term_restore (void);
+void       term_resized (void);
+int        term_width   (void);
+int        term_height  (void);
+void       term_write   (const char*, int);
+void       term_puts    (const char*);
+void       term_printf  (const char*, ...);
+void       term_putwc   (wint_t);
+void       term_flush   (void);
+term_frame term_stats   (void);
+
+#endif /* TERM_GUARD */
@@ -0,0 +1,250 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wctype.h>
+#include "trigram.h"
+
+#define INDEX_BLOCK (64 << 10)
+
+/* the summary of a leaf, a bit set of 2^(32 - shift) bits */
+typedef struct leaf_summary {
+    int      shift;
+    long     size;                  /* bytes of the block */
+    uint64_t bits[];
+} leaf_summary;
+
+static uint32_t hash_trigram(wint_t a, wint_t b, wint_t c) {
+    uint32_t h = a * 0x9E3779B1u ^ b * 0x85EBCA77u ^ c * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 13;
+    return h;
+}
+
+/* both the rows and the patterns are indexed in lower case, so that
+ * the index serves searches with and without case folding */
+static wint_t fold(wint_t c) {
+    if (c < 0x80) return c >= 'A' && c <= 'Z' ? c + 32 : c;
+    return towlower(c);
+}
+
+/* sets the bits of the trigrams of row in s, a block of at most
+ * INDEX_BLOCK characters at a time; consecutive blocks overlap by two
+ * characters so that no trigram is lost */
+static void index_row(leaf_summary *s, readline *row, wint_t *scratch) {
+    for (int from = 0; from + 2 < row->line_end; from += INDEX_BLOCK - 2) {
+        int n = row->line_end - from;
+        if (n > INDEX_BLOCK) n = INDEX_BLOCK;
+        if (row_is_ascii(row)) {
+            const unsigned char *text = (const unsigned char *) &row->text[from];
+            for (int i = 0; i < n; i++) scratch[i] = fold(text[i]);
+        } else {
+            row_copy_out(row, from, n, scratch);
+            for (int i = 0; i < n; i++) scratch[i] = fold(scratch[i]);
+        }
+        for (int i = 0; i + 2 < n; i++) {
+            uint32_t bit = hash_trigram(scratch[i], scratch[i+1], scratch[i+2]) >> s->shift;
+            s->bits[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+        }
+    }
+}
+
+/* builds the summary of a leaf with about two bits per trigram */
+static void index_leaf(line_node *leaf) {
+    long grams   = 0;
+    int  longest = 0;
+    lines_page_in_leaf(leaf);
+    for (int i = 0; i < leaf->count; i++) {
+        int n = leaf->entry.row[i]->line_end;
+        if (n > 2) grams += n - 2;
+        if (n > longest) longest = n;
+    }
+    if (longest > INDEX_BLOCK) longest = INDEX_BLOCK;
+    int bits = 6;
+    while (bits < 31 && (1L << bits) < 2 * grams) bits++;
+    long size = sizeof(leaf_summary) + ((1L << bits) / 64) * sizeof(uint64_t);
+    leaf_summary *s = calloc(1, size);
+    s->shift = 32 - bits;
+    s->size  = size;
+    wint_t *scratch = malloc(sizeof(wint_t) * (longest > 0 ? longest : 1));
+    for (int i = 0; i < leaf->count; i++)
+        index_row(s, leaf->entry.row[i], scratch);
+    free(scratch);
+    free(leaf->summary);
+    leaf->summary = s;
+}
+
+/* FALSE if the leaf cannot contain every trigram in hashes */
+static int leaf_may_match(line_node *leaf, const uint32_t *hashes, int n) {
+    leaf_summary *s = leaf->summary;
+    for (int i = 0; i < n; i++) {
+        uint32_t bit = hashes[i] >> s->shift;
+        if (!(s->bits[bit >> 6] >> (bit & 63) & 1)) return 0;
+    }
+    return 1;
+}
+
+static uint32_t *pattern_trigrams(search_pattern *p, int *n) {
+    *n = p->length - 2;
+    uint32_t *hashes = malloc(sizeof(uint32_t) * *n);
+    for (int i = 0; i < *n; i++)
+        hashes[i] = hash_trigram(fold(p->chars[i]), fold(p->chars[i+1]),
+                                 fold(p->chars[i+2]));
+    return hashes;
+}
+
+/*-----------------------------------------------  
+    background build
+ -----------------------------------------------*/
+
+static void *build(void *arg) {
+    trigram_index *t = arg;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    /* rows inserted or removed meanwhile shift the position by a few
+     * rows, a leaf missed that way is indexed by the next search */
+    int row = 0;
+    while (1) {
+        pthread_mutex_lock(&t->lock);
+        line_iter iter;
+        if (t->cancel || lines_iter_start(*t->rows, row, &iter) == NULL) {
+            pthread_mutex_unlock(&t->lock);
+            break;
+        }
+        for (int k = 0; k < TRIGRAM_BATCH && iter.leaf; k++) {
+            if (iter.leaf->summary == NULL) index_leaf(iter.leaf);
+            row += iter.leaf->count - iter.pos;
+            iter.leaf = iter.leaf->next;
+            iter.pos  = 0;
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_mutex_lock(&t->lock);
+    if (!t->cancel) {
+        t->built   = 1;
+        t->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+void trigram_init(trigram_index *t, line_node **rows) {
+    memset(t, 0, sizeof(trigram_index));
+    t->rows = rows;
+    pthread_mutex_init(&t->lock, NULL);
+}
+
+/* Starts the builder. The caller holds the lock. */
+void trigram_start(trigram_index *t) {
+    if (t->enabled) return;
+    t->enabled = 1;
+    t->cancel  = 0;
+    t->built   = 0;
+    t->running = pthread_create(&t->builder, NULL, build, t) == 0;
+}
+
+/* Stops the builder and drops the index. The caller holds the lock,
+ * which is released while waiting for the builder. */
+void trigram_stop(trigram_index *t) {
+    if (!t->enabled) return;
+    if (t->running) {
+        t->cancel = 1;
+        pthread_mutex_unlock(&t->lock);
+        pthread_join(t->builder, NULL);
+        pthread_mutex_lock(&t->lock);
+        t->running = 0;
+    }
+    line_iter iter;
+    lines_iter_start(*t->rows, 0, &iter);
+    for (line_node *leaf = iter.leaf; leaf != NULL; leaf = leaf->next) {
+        free(leaf->summary);
+        leaf->summary = NULL;
+    }
+    t->enabled = 0;
+    t->built   = 0;
+}
+
+void trigram_lock(trigram_index *t) {
+    pthread_mutex_lock(&t->lock);
+}
+
+void trigram_unlock(trigram_index *t) {
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* The text of row changed. Inserting and removing rows drops the
+ * summaries of the leaves involved by itself. */
+void trigram_touch(trigram_index *t, int row) {
+    if (t->enabled) lines_touch(*t->rows, row);
+}
+
+/*-----------------------------------------------  
+    searching
+ -----------------------------------------------*/
+
+/* TRUE if the index can narrow a search for p */
+int trigram_usable(trigram_index *t, search_pattern *p) {
+    return t->enabled && p->length >= 3 && p->lines == 0;
+}
+
+/* Finds the first match at or after character from of row, looking
+ * only into leaves that may hold it. Returns FALSE if there is none. */
+int trigram_forward(trigram_index *t, search_pattern *p, int row, int from,
+                    search_match *match) {
+    line_node *rows = *t->rows;
+    line_iter iter;
+    if (lines_iter_start(rows, row, &iter) == NULL) return 0;
+    int n;
+    uint32_t *hashes = pattern_trigrams(p, &n);
+    int found = 0;
+    while (iter.leaf && !found) {
+        line_node *leaf = iter.leaf;
+        int left = leaf->count - iter.pos;
+        /* leaves changed since they were indexed are indexed again
+         * on the way, that costs about as much as searching them */
+        if (leaf->summary == NULL) index_leaf(leaf);
+        if (leaf_may_match(leaf, hashes, n))
+            found = search_span(p, rows, rows->lines, row, row + left, from, match);
+        row      += left;
+        from      = 0;
+        iter.leaf = leaf->next;
+        iter.pos  = 0;
+    }
+    free(hashes);
+    return found;
+}
+
+/* Memory held by the index and the number of leaves it covers. */
+void trigram_stats(trigram_index *t, long *memory, int *indexed, int *leaves) {
+    *memory  = 0;
+    *indexed = 0;
+    *leaves  = 0;
+    line_iter iter;
+    lines_iter_start(*t->rows, 0, &iter);
+    for (line_node *leaf = iter.leaf; leaf != NULL; leaf = leaf->next) {
+        leaf_summary *s = leaf->summary;
+        (*leaves)++;
+        if (s == NULL) continue;
+        (*indexed)++;
+        *memory += s->size;
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRIGRAM_GUARD
+#define TRIGRAM_GUARD
+
+#include <pthread.h>
+#include "search.h"
+
+/* documents smaller than this are searched without an index */
+#define TRIGRAM_MIN_SIZE (8 << 20)
+
+/* leaves indexed by the builder each time it holds the lock */
+#define TRIGRAM_BATCH 256
+
+/* Trigram index over the leaves of the line tree. Every leaf carries a
+ * bit set with one bit per trigram of its rows, hashed to about two
+ * bits per trigram. A literal search skips the leaves that lack a
+ * trigram of the pattern and verifies the others with search_span.
+ *
+ * The index is built by a background thread after a file is loaded.
+ * The editor holds the lock except while it waits for a key, so the
+ * builder only runs while the editor is idle. An edit drops the
+ * summary of its leaf in the line tree, the next search over the leaf
+ * indexes its rows again. */
+typedef struct trigram_index {
+    char            enabled;
+    char            running;        /* builder thread started */
+    char            cancel;
+    char            built;          /* every leaf was indexed once */
+    pthread_t       builder;
+    pthread_mutex_t lock;
+    line_node     **rows;           /* the document, the root may change */
+    double          seconds;        /* time the build took */
+} trigram_index;
+
+void trigram_init    (trigram_index*, line_node**);
+void trigram_start   (trigram_index*);
+void trigram_stop    (trigram_index*);
+void trigram_lock    (trigram_index*);
+void trigram_unlock  (trigram_index*);
+void trigram_touch   (trigram_index*, int);
+int  trigram_usable  (trigram_index*, search_pattern*);
+int  trigram_forward (trigram_index*, search_pattern*, int, int, search_match*);
+void trigram_stats   (trigram_index*, long*, int*, int*);
+
+#endif /* TRIGRAM_GUARD */
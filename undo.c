@@ -0,0 +1,219 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "undo.h"
+
+/* bytes an entry with room bytes of text takes in a block */
+static long entry_size(long room) {
+    return (sizeof(undo_entry) + room + 7) & ~7L;
+}
+
+static int encode(const wint_t *text, int length, char *out) {
+    char *start = out;
+    for (int i = 0; i < length; i++) {
+        if (text[i] < 0x80) *out++ = text[i];
+        else                out += utf8_encode(text[i], out);
+    }
+    return out - start;
+}
+
+static void free_blocks(undo_block *b) {
+    while (b != NULL) {
+        undo_block *next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+void undo_init(undo_log *log) {
+    memset(log, 0, sizeof(undo_log));
+    const char *env = getenv("MX_UNDO_LIMIT");
+    log->limit = env ? atol(env) << 20 : UNDO_LIMIT;
+}
+
+void undo_free(undo_log *log) {
+    free_blocks(log->first);
+    log->first  = log->last   = NULL;
+    log->oldest = log->newest = log->top = NULL;
+    log->memory = 0;
+}
+
+/* every key is a command, the edits of one command are undone together */
+void undo_command(undo_log *log) {
+    log->command++;
+}
+
+/* drop the oldest blocks while the log is over its limit, the newest
+ * block always stays */
+static void trim(undo_log *log) {
+    while (log->memory > log->limit && log->first != log->last) {
+        undo_block *b = log->first;
+        while ((char *) log->oldest >= b->data
+               && (char *) log->oldest < b->data + b->used)
+            log->oldest = log->oldest->next;
+        log->oldest->prev = NULL;
+        log->first   = b->next;
+        log->memory -= b->size + sizeof(undo_block);
+        free(b);
+    }
+}
+
+/* cut an entry with room bytes of text from the newest block */
+static undo_entry *allocate(undo_log *log, long room) {
+    long size = entry_size(room);
+    undo_block *b = log->last;
+    if (b == NULL || b->used + size > b->size) {
+        long block_size = UNDO_BLOCK_SIZE;
+        if (block_size < (long) sizeof(undo_block) + size)
+            block_size = sizeof(undo_block) + size;
+        b = malloc(block_size);
+        b->next = NULL;
+        b->size = block_size - sizeof(undo_block);
+        b->used = 0;
+        if (log->last) log->last->next = b;
+        else           log->first      = b;
+        log->last    = b;
+        log->memory += block_size;
+    }
+    undo_entry *e = (undo_entry *) &b->data[b->used];
+    b->used += size;
+    e->room  = room;
+    return e;
+}
+
+/* append e to the log, it becomes the top */
+static void append(undo_log *log, undo_entry *e) {
+    e->prev = log->newest;
+    e->next = NULL;
+    if (log->newest) log->newest->next = e;
+    else             log->oldest       = e;
+    log->newest = log->top = e;
+    trim(log);
+}
+
+/* a new edit: what was undone can no longer be redone */
+static void drop_redo(undo_log *log) {
+    if (log->top == log->newest) return;
+    if (log->top == NULL) {
+        undo_free(log);
+        return;
+    }
+    undo_block *b = log->first;
+    char *top = (char *) log->top;
+    while (top < b->data || top >= b->data + b->used) b = b->next;
+    b->used = top + entry_size(log->top->room) - b->data;
+    for (undo_block *r = b->next; r != NULL; r = r->next)
+        log->memory -= r->size + sizeof(undo_block);
+    free_blocks(b->next);
+    b->next         = NULL;
+    log->last       = b;
+    log->top->next  = NULL;
+    log->newest     = log->top;
+}
+
+/* make room for bytes more bytes of text in the newest entry, it grows
+ * in place at the end of its block or moves to a new one */
+static undo_entry *grow(undo_log *log, undo_entry *e, int bytes) {
+    if (e->bytes + bytes <= e->room) return e;
+    undo_block *b = log->last;
+    long more = entry_size(2 * (e->bytes + bytes)) - entry_size(e->room);
+    if ((char *) e + entry_size(e->room) == b->data + b->used
+        && b->used + more <= b->size) {
+        b->used += more;
+        e->room  = 2 * (e->bytes + bytes);
+        return e;
+    }
+    undo_entry *moved = allocate(log, 2 * (e->bytes + bytes));
+    int room = moved->room;
+    memcpy(moved, e, sizeof(undo_entry) + e->bytes);
+    moved->room = room;
+    if (moved->prev) moved->prev->next = moved;
+    else             log->oldest       = moved;
+    log->newest = log->top = moved;
+    trim(log);
+    return moved;
+}
+
+/* Log an edit of the document at (row, cursor). A single character
+ * next to a run of the same kind joins it, if the run is from the
+ * current command or was typed one character per command. */
+void undo_record(undo_log *log, int kind, int row, int cursor,
+                 const wint_t *text, int length) {
+    if (length <= 0) return;
+    drop_redo(log);
+    undo_entry *e = log->newest;
+    if (length == 1 && text[0] != '\n' && e != NULL && e->kind == kind
+        && e->row == row && (e->group == log->command
+                             || (e->open && e->group == log->command - 1))) {
+        char c[4];
+        int  n = encode(text, 1, c);
+        if (kind == UNDO_INSERT && e->cursor + e->length == cursor) {
+            e = grow(log, e, n);
+            memcpy(&e->text[e->bytes], c, n);
+        } else if (kind == UNDO_DELETE && e->cursor == cursor) {
+            e = grow(log, e, n);
+            memcpy(&e->text[e->bytes], c, n);
+        } else if (kind == UNDO_ERASE && e->cursor == cursor + 1) {
+            e = grow(log, e, n);
+            memmove(&e->text[n], e->text, e->bytes);
+            memcpy(e->text, c, n);
+            e->cursor = cursor;
+        } else {
+            goto NEW;
+        }
+        /* a command that inserts several characters, a yank, is not
+         * continued by the next one */
+        if (e->group == log->command) e->open = 0;
+        e->bytes += n;
+        e->length++;
+        e->group = log->command;
+        return;
+    }
+    NEW:;
+    int bytes = 0;
+    for (int i = 0; i < length; i++) {
+        char c[4];
+        bytes += text[i] < 0x80 ? 1 : utf8_encode(text[i], c);
+    }
+    /* a run keeps some room to grow in place */
+    int open = length == 1 && text[0] != '\n';
+    e = allocate(log, open ? 16 : bytes);
+    e->group  = log->command;
+    e->row    = row;
+    e->cursor = cursor;
+    e->length = length;
+    e->kind   = kind;
+    e->open   = open;
+    e->bytes  = encode(text, length, e->text);
+    append(log, e);
+}
+
+/* the entry redo applies next, NULL if there is none */
+undo_entry *undo_next(undo_log *log) {
+    return log->top ? log->top->next : log->oldest;
+}
+
+/* decode the text of e into out, which holds e->length characters */
+int undo_text(undo_entry *e, wint_t *out) {
+    const unsigned char *s = (const unsigned char *) e->text;
+    int b = 0, n = 0;
+    while (b < e->bytes)
+        b += utf8_decode(&s[b], e->bytes - b, &out[n++]);
+    return n;
+}
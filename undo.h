@@ -0,0 +1,80 @@
+/*
+ *  This file is part of the mx text editor.
+ *
+ *  mx is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mx is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mx.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNDO_GUARD
+#define UNDO_GUARD
+
+#include "row.h"
+
+/* memory of the log unless MX_UNDO_LIMIT gives it in megabytes, the
+ * oldest entries are dropped beyond it */
+#define UNDO_LIMIT      (64 << 20)
+#define UNDO_BLOCK_SIZE (64 << 10)
+
+enum undo_kind {
+    UNDO_INSERT,  /* text was inserted at row, cursor */
+    UNDO_DELETE,  /* text was deleted after the cursor */
+    UNDO_ERASE    /* text was deleted before the cursor */
+};
+
+/* One edit of the document. The text follows the entry as UTF-8, a
+ * newline stands for a line break. Entries are cut from large blocks
+ * and never move, the log links them in the order of the edits. */
+typedef struct undo_entry {
+    struct undo_entry *prev;
+    struct undo_entry *next;
+    int  group;    /* command that made the edit */
+    int  row;
+    int  cursor;
+    int  length;   /* characters */
+    int  bytes;    /* bytes of text */
+    int  room;     /* bytes reserved for text */
+    char kind;
+    char open;     /* typed one character per command, may grow */
+    char text[];
+} undo_entry;
+
+typedef struct undo_block {
+    struct undo_block *next;
+    long size;
+    long used;
+    char data[];
+} undo_block;
+
+/* Undo steps back over all entries of the newest group, redo forward
+ * over the entries after top. A new edit drops what could be redone.
+ * Self-inserts, C-d and backspace in a row extend the newest entry
+ * while the commands follow each other. */
+typedef struct undo_log {
+    undo_block *first;
+    undo_block *last;
+    undo_entry *oldest;
+    undo_entry *newest;
+    undo_entry *top;       /* newest entry not undone, NULL if none */
+    long        memory;
+    long        limit;
+    int         command;   /* number of the current command */
+} undo_log;
+
+void        undo_init    (undo_log*);
+void        undo_free    (undo_log*);
+void        undo_command (undo_log*);
+void        undo_record  (undo_log*, int, int, int, const wint_t*, int);
+undo_entry* undo_next    (undo_log*);
+int         undo_text    (undo_entry*, wint_t*);
+
+#endif /* UNDO_GUARD */